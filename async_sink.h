@@ -0,0 +1,149 @@
+#ifndef ASYNC_SINK_H_INCLUDED
+#define ASYNC_SINK_H_INCLUDED
+#include "output_sink.h"
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+
+// Presents frames to another sink on a thread of its own, so the next frame is traced while the previous one
+// is written out and a frame costs the longer of tracing and presenting instead of their sum. present() copies
+// the frame into one of num_buffers buffers: one is being presented, the others wait in order. When all of them
+// are taken, BLOCK waits for the presenting thread and DROP_OLDEST replaces the oldest frame that still waits,
+// which keeps the display on the newest frame when the sink is slower than the renderer.
+class AsyncSink : public OutputSink {
+public:
+    enum Backpressure { BLOCK, DROP_OLDEST };
+
+private:
+    struct Frame {
+        std::vector<char> screen;
+        int width = 0;
+        int height = 0;
+    };
+
+    std::unique_ptr<OutputSink> sink;
+    Backpressure backpressure;
+    std::vector<Frame> frames;
+    std::deque<int> queued;  // frames waiting to be presented, oldest first
+    std::vector<int> free_frames;
+    bool presenting = false;
+    bool stopping = false;
+    std::exception_ptr error;
+    long long presented_count = 0;
+    long long dropped_count = 0;
+
+    std::mutex mutex;
+    std::condition_variable frame_queued;
+    std::condition_variable frame_done;
+    std::thread worker;
+
+    void rethrow_error() {
+        if (error) {
+            std::exception_ptr e = error;
+            error = nullptr;
+            std::rethrow_exception(e);
+        }
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            frame_queued.wait(lock, [this] { return stopping || !queued.empty(); });
+            if (queued.empty()) {
+                return;
+            }
+            const int k = queued.front();
+            queued.pop_front();
+            presenting = true;
+            lock.unlock();
+            try {
+                sink->present(frames[k].screen.data(), frames[k].width, frames[k].height);
+            } catch (...) {
+                lock.lock();
+                error = std::current_exception();
+                lock.unlock();
+            }
+            lock.lock();
+            presenting = false;
+            free_frames.push_back(k);
+            ++presented_count;
+            frame_done.notify_all();
+        }
+    }
+
+public:
+    explicit AsyncSink(std::unique_ptr<OutputSink> sink, int num_buffers = 2, Backpressure backpressure = BLOCK)
+        : sink(std::move(sink)), backpressure(backpressure), frames(num_buffers) {
+        if (!this->sink) {
+            throw std::invalid_argument("Sink cannot be null");
+        }
+        if (num_buffers < 2) {
+            throw std::invalid_argument("An asynchronous sink needs at least two buffers");
+        }
+        for (int k = num_buffers - 1; k >= 0; --k) {
+            free_frames.push_back(k);
+        }
+        worker = std::thread([this] { run(); });
+    }
+
+    AsyncSink(const AsyncSink&) = delete;
+    AsyncSink& operator=(const AsyncSink&) = delete;
+
+    // rethrows, on the rendering thread, an exception the sink threw while presenting an earlier frame
+    void present(const char* screen, int width, int height) override {
+        std::unique_lock<std::mutex> lock(mutex);
+        rethrow_error();
+        if (free_frames.empty() && backpressure == DROP_OLDEST) {
+            free_frames.push_back(queued.front());
+            queued.pop_front();
+            ++dropped_count;
+        }
+        frame_done.wait(lock, [this] { return !free_frames.empty(); });
+        const int k = free_frames.back();
+        free_frames.pop_back();
+        lock.unlock();
+
+        frames[k].screen.assign(screen, screen + width * height);
+        frames[k].width = width;
+        frames[k].height = height;
+
+        lock.lock();
+        queued.push_back(k);
+        frame_queued.notify_one();
+    }
+
+    // waits until every frame handed over so far has been presented or dropped
+    void flush() {
+        std::unique_lock<std::mutex> lock(mutex);
+        frame_done.wait(lock, [this] { return queued.empty() && !presenting; });
+        rethrow_error();
+    }
+
+    long long get_presented_frames() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return presented_count;
+    }
+
+    long long get_dropped_frames() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return dropped_count;
+    }
+
+    // presents the frames still waiting before the thread stops
+    ~AsyncSink() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        frame_queued.notify_one();
+        worker.join();
+    }
+};
+
+#endif //ASYNC_SINK_H_INCLUDED
@@ -0,0 +1,735 @@
+#include "engine.h"
+#include "mesh.h"
+#include "instance.h"
+#include "scene_file.h"
+#include "chrome_trace.h"
+#include "reference_tracer.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+// axes: X - left, Z - forward, Y - down
+//
+// Renders a fixed number of frames of the example scenes and of random stress scenes without drawing them
+// and reports the frame rate, ray counts and frame latencies as text, and as JSON with --json. Built with
+// -DRT_PROFILE it also reports intersection tests by object type; --trace writes the frames as Chrome trace events.
+//
+// --verify N instead checks the shape of BVHs built over random and skewed boxes, then renders N random scenes
+// of --objects objects, one per seed from --seed on, through every rendering path of the engine and compares
+// each frame with ReferenceTracer, reporting the pixels whose characters are more than --tolerance steps of
+// the gradient apart, apart from those only the rounding of the camera's rays explains; it exits with 1 when the
+// BVH check fails or an exact path differs.
+//
+// usage: bench [--frames N] [--warmup N] [--width N] [--height N] [--reflections N] [--threads N] [--packet N]
+//              [--progressive N] [--budget N] [--adaptive 0|1] [--temporal N] [--adaptive-depth 0|1] [--target-fps N]
+//              [--scene example1|example2|example3|random|dynamic|mesh|instances] [--objects N] [--seed N]
+//              [--moving N] [--triangles N] [--obj FILE] [--file FILE] [--json FILE] [--trace FILE]
+//              [--verify N] [--tolerance N]
+
+
+struct BenchOptions {
+    int frames = 0; // 0: 100, or 4 per scene and path with --verify
+    int warmup = 2;
+    int width = 274;
+    int height = 66;
+    int reflections = 5;
+    int threads = 1;
+    int packet = 0;
+    int progressive = 0;
+    long long budget = 0;
+    bool adaptive = false;
+    int temporal = 0;
+    bool adaptive_depth = false;
+    float target_fps = 0;
+    int objects = 200;
+    int moving = -1; // objects moved per frame in the dynamic scene, a tenth of them by default
+    int triangles = 100000;
+    std::string obj;
+    std::string file; // scene file, benchmarked as the scene "file"
+    unsigned seed = 1;
+    std::string scene;
+    std::string json;
+    std::string trace;
+    int verify = 0;
+    int tolerance = 0;
+};
+
+
+struct BenchScene {
+    std::string name;
+    std::function<void(RaytracingEngine&)> setup;
+    std::function<void(RaytracingEngine&)> animate;
+};
+
+
+struct BenchResult {
+    std::string name;
+    int frames = 0;
+    double total_time = 0;
+    double p50 = 0;
+    double p99 = 0;
+    FrameStats stats;
+    ProfileCounters counters;
+};
+
+
+// torus lying on the y = 0 plane with about the given number of triangles
+void make_torus(int num_triangles, std::vector<Vec3>& vertices, std::vector<int>& indices) {
+    const int rings = std::max(3, static_cast<int>(std::sqrt(num_triangles / 2.0 * 1.8)));
+    const int sides = std::max(3, num_triangles / (2 * rings));
+    for (int a = 0; a < rings; ++a) {
+        for (int b = 0; b < sides; ++b) {
+            float u = 2 * M_PI * a / rings;
+            float w = 2 * M_PI * b / sides;
+            vertices.push_back(Vec3((0.7 + 0.25 * std::cos(w)) * std::cos(u), -0.25 - 0.25 * std::sin(w), (0.7 + 0.25 * std::cos(w)) * std::sin(u)));
+        }
+    }
+    for (int a = 0; a < rings; ++a) {
+        for (int b = 0; b < sides; ++b) {
+            int p = a * sides + b, q = (a + 1) % rings * sides + b;
+            int r = (a + 1) % rings * sides + (b + 1) % sides, s = a * sides + (b + 1) % sides;
+            indices.insert(indices.end(), {p, q, r, p, r, s});
+        }
+    }
+}
+
+
+// objects of random kinds scattered over a chessboard that grows with their number, returned without the board
+std::vector<Object*> add_random_objects(RaytracingEngine& engine, int num_objects, unsigned seed) {
+    std::mt19937 rng(seed);
+    const float extent = 1 + std::sqrt(static_cast<float>(num_objects)) * 0.4f;
+    std::uniform_real_distribution<float> position(-extent, extent);
+    std::uniform_real_distribution<float> size(0.1, 0.3);
+    std::uniform_real_distribution<float> coeff(0.2, 1);
+    std::uniform_int_distribution<int> kind(0, 4);
+
+    engine.camera.set_position({0, -extent, -2 * extent});
+    engine.light.set_position({0, -10 * extent, -10 * extent});
+    engine.scene.add_object(ChessPlane({0, 0, 0}, 0.5, 0.1, 0.3));
+    std::vector<Object*> objects;
+    for (int k = 0; k < num_objects; ++k) {
+        Vec3 base(position(rng), 0, position(rng));
+        float s = size(rng);
+        switch (kind(rng)) {
+            case 0: objects.push_back(&engine.scene.add_object(Sphere(base + Vec3(0, -s, 0), s, coeff(rng)))); break;
+            case 1: objects.push_back(&engine.scene.add_object(Cube(base, {0, -1, 0}, {0, 0, 1}, 2 * s, coeff(rng)))); break;
+            case 2: objects.push_back(&engine.scene.add_object(RectPrism(base, {0, -1, 0}, {1, 0, 0}, 3 * s, s, 2 * s, coeff(rng)))); break;
+            case 3: objects.push_back(&engine.scene.add_object(Cylinder(base, {0, -1, 0}, s, 3 * s, coeff(rng)))); break;
+            case 4: objects.push_back(&engine.scene.add_object(Cone(base, {0, -1, 0}, s, 3 * s, coeff(rng)))); break;
+        }
+    }
+    return objects;
+}
+
+
+std::vector<BenchScene> make_scenes(const BenchOptions& options) {
+    std::vector<BenchScene> scenes;
+
+    scenes.push_back({"example1",
+        [](RaytracingEngine& engine) {
+            engine.camera.set_position({0, -1.2, -1.2});
+            engine.light.set_position({0, -10, -10});
+            engine.scene.add_object(ChessPlane({0, 0, 0}, 0.5, 0.1, 0.3));
+            engine.scene.add_object(Sphere({-1, -0.5, 0}, 0.5, 1));
+            engine.scene.add_object(Cone({0, -0.75, -1}, {0, 1, 0}, 0.3, 0.75, 1));
+            engine.scene.add_object(RectPrism({1, 0, 0}, {0, -1, 0}, {0, 0, 1}, 1, 1, 0.5, 1));
+            engine.scene.add_object(Cylinder({0.1768, -0.5, 0.8232}, {-1, 0, 1}, 0.35, 0.5, 1));
+        },
+        [](RaytracingEngine& engine) {
+            engine.camera.rotate_around_origin({0.023, 0.025, 0.025});
+        }});
+
+    scenes.push_back({"example2",
+        [](RaytracingEngine& engine) {
+            engine.camera.set_position({0, -0.1, -0.6});
+            engine.light.set_position({0, -100, -100});
+            engine.scene.add_object(ChessPlane({0, 0, 0}, 0.5, 0.1, 0.3));
+            engine.scene.add_object(Sphere({-0.5, -0.5, 0}, 0.5, 1));
+            engine.scene.add_object(Sphere({0.5, -0.5, 0}, 0.5, 1));
+        },
+        [angular_velocity = Vec3(0, 0.025, 0)](RaytracingEngine& engine) mutable {
+            Vec3 camera_focus = {0, -0.5, 0};
+            engine.camera.rotate_around_point(camera_focus, angular_velocity);
+            if (fabs((engine.camera.get_position() - camera_focus).dot({0, 0, 1})) < 0.5) {
+                angular_velocity = -angular_velocity;
+            }
+        }});
+
+    scenes.push_back({"example3",
+        [](RaytracingEngine& engine) {
+            engine.camera.set_position({0, -1.2, -1.2});
+            engine.light.set_position({0, -1, 0});
+            engine.scene.add_object(ChessPlane({0, 0, 0}, 0.5, 0.1, 0.3));
+            engine.scene.add_object(Sphere({-1, -0.5, 0}, 0.5, 1));
+            engine.scene.add_object(Cone({0, 0, -1}, {0, -1, 0}, 0.4, 1, 1));
+            engine.scene.add_object(Cube({1, 0, 0}, {0, -1, 0}, {0, 0, 1}, 0.75, 1));
+            engine.scene.add_object(Cylinder({0, 0, 1}, {0, -1, 0}, 0.2, 0.9, 1));
+        },
+        [](RaytracingEngine& engine) {
+            engine.camera.rotate_around_origin({0, 0.025, 0});
+        }});
+
+    const int num_objects = options.objects;
+    const unsigned seed = options.seed;
+    scenes.push_back({"random" + std::to_string(num_objects),
+        [num_objects, seed](RaytracingEngine& engine) {
+            add_random_objects(engine, num_objects, seed);
+        },
+        [](RaytracingEngine& engine) {
+            engine.camera.rotate_around_origin({0, 0.025, 0});
+        }});
+
+    // the random scene with objects sliding back and forth, so every frame refits the BVH
+    const int num_moving = options.moving >= 0 ? options.moving : num_objects / 10;
+    auto moving = std::make_shared<std::vector<Object*>>();
+    scenes.push_back({"dynamic" + std::to_string(num_objects),
+        [num_objects, seed, moving](RaytracingEngine& engine) {
+            *moving = add_random_objects(engine, num_objects, seed);
+        },
+        [num_moving, moving, frame = 0](RaytracingEngine& engine) mutable {
+            engine.camera.rotate_around_origin({0, 0.025, 0});
+            const int count = std::min(num_moving, static_cast<int>(moving->size()));
+            for (int k = 0; k < count; ++k) {
+                // each object swings along its own direction with a period of 40 frames
+                float phase = static_cast<float>(k);
+                Vec3 dir(std::cos(phase), 0, std::sin(phase));
+                float step = std::sin(2 * M_PI * (frame + 1) / 40) - std::sin(2 * M_PI * frame / 40);
+                engine.scene.move_object((*moving)[k], dir * step);
+            }
+            ++frame;
+        }});
+
+    // a torus of about the given number of triangles, or the OBJ model fitted into the same space
+    const int num_triangles = options.triangles;
+    const std::string obj_path = options.obj;
+    scenes.push_back({"mesh" + (obj_path.empty() ? std::to_string(num_triangles) : std::string()),
+        [num_triangles, obj_path](RaytracingEngine& engine) {
+            engine.camera.set_position({0, -1.2, -1.2});
+            engine.light.set_position({0, -10, -10});
+            engine.scene.add_object(ChessPlane({0, 0, 0}, 0.5, 0.1, 0.3));
+
+            std::vector<Vec3> vertices;
+            std::vector<int> indices;
+            if (obj_path.empty()) {
+                make_torus(num_triangles, vertices, indices);
+            } else {
+                // OBJ models are y-up: flip them onto the plane and scale them to a unit box
+                TriangleMesh model = TriangleMesh::load_obj(obj_path, 1);
+                AABB box = model.bounding_box().value_or(AABB(Vec3(), Vec3(1, 1, 1)));
+                Vec3 size = box.max - box.min;
+                float scale = 1.5f / std::max(size.x, std::max(size.y, size.z));
+                for (const Vec3& v : model.get_vertices()) {
+                    Vec3 c = v - box.center();
+                    vertices.push_back(Vec3(c.x * scale, -(v.y - box.min.y) * scale, c.z * scale));
+                }
+                indices = model.get_indices();
+            }
+            engine.scene.add_object(TriangleMesh(std::move(vertices), std::move(indices), 0.5));
+        },
+        [](RaytracingEngine& engine) {
+            engine.camera.rotate_around_origin({0, 0.025, 0});
+        }});
+
+    // copies of one torus mesh of --triangles / 10 triangles and of one cone, turned and scattered like the random scene
+    scenes.push_back({"instances" + std::to_string(num_objects),
+        [num_objects, num_triangles, seed](RaytracingEngine& engine) {
+            std::mt19937 rng(seed);
+            const float extent = 1 + std::sqrt(static_cast<float>(num_objects)) * 0.4f;
+            std::uniform_real_distribution<float> position(-extent, extent);
+            std::uniform_real_distribution<float> angle(0, 2 * M_PI);
+            std::uniform_real_distribution<float> size(0.1, 0.3);
+
+            std::vector<Vec3> vertices;
+            std::vector<int> indices;
+            make_torus(std::max(100, num_triangles / 10), vertices, indices);
+            auto torus = std::make_shared<TriangleMesh>(std::move(vertices), std::move(indices), 0.5);
+            auto cone = std::make_shared<Cone>(Vec3(0, 0, 0), Vec3(0, -1, 0), 1, 2, 1);
+
+            engine.camera.set_position({0, -extent, -2 * extent});
+            engine.light.set_position({0, -10 * extent, -10 * extent});
+            engine.scene.add_object(ChessPlane({0, 0, 0}, 0.5, 0.1, 0.3));
+            for (int k = 0; k < num_objects; ++k) {
+                Vec3 base(position(rng), 0, position(rng));
+                float s = size(rng);
+                if (k % 2 == 0) {
+                    engine.scene.add_object(Instance(torus, Vec3(0, angle(rng), 0), base, s));
+                } else {
+                    engine.scene.add_object(Instance(cone, Vec3(0.5f * angle(rng) / M_PI, angle(rng), 0), base, s));
+                }
+            }
+        },
+        [](RaytracingEngine& engine) {
+            engine.camera.rotate_around_origin({0, 0.025, 0});
+        }});
+
+    if (!options.file.empty()) {
+        auto scene_file = std::make_shared<SceneFile>(SceneFile::load(options.file));
+        scenes.push_back({"file",
+            [scene_file](RaytracingEngine& engine) {
+                scene_file->apply(engine);
+            },
+            [scene_file](RaytracingEngine& engine) {
+                scene_file->animate(engine);
+            }});
+    }
+
+    return scenes;
+}
+
+
+double percentile(std::vector<double> values, double p) {
+    if (values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    size_t rank = static_cast<size_t>(std::ceil(p * values.size()));
+    return values[std::min(values.size() - 1, rank > 0 ? rank - 1 : 0)];
+}
+
+
+BenchResult run(const BenchScene& bench_scene, const BenchOptions& options, ChromeTraceWriter* trace, int& trace_frame) {
+    const float pixel_aspect = 0.5;
+    RaytracingEngine engine(options.width, options.height, pixel_aspect, options.reflections, options.threads);
+    engine.set_packet_size(options.packet);
+    engine.set_progressive(options.progressive, options.budget, options.adaptive);
+    engine.set_temporal_reuse(options.temporal);
+    engine.set_adaptive_depth(options.adaptive_depth);
+    engine.set_target_fps(options.target_fps);
+    bench_scene.setup(engine);
+    auto animate = bench_scene.animate;
+
+    for (int k = 0; k < options.warmup; ++k) {
+        engine.render_frame();
+        animate(engine);
+    }
+
+    BenchResult result;
+    result.name = bench_scene.name;
+    result.frames = options.frames;
+    std::vector<double> latencies;
+    for (int k = 0; k < options.frames; ++k) {
+        auto start = std::chrono::steady_clock::now();
+        engine.render_frame();
+        auto end = std::chrono::steady_clock::now();
+        latencies.push_back(std::chrono::duration<double>(end - start).count());
+        result.total_time += latencies.back();
+        result.stats += engine.get_frame_stats();
+        result.counters += engine.get_profile_counters();
+        if (trace) {
+            trace->add_frame(trace_frame++, start, engine.get_frame_stats(), engine.get_profile_counters());
+        }
+        animate(engine);
+    }
+    result.p50 = percentile(latencies, 0.5);
+    result.p99 = percentile(latencies, 0.99);
+    return result;
+}
+
+
+void print_text(const std::vector<BenchResult>& results) {
+    std::printf("%-12s %7s %9s %9s %12s %12s %12s %9s %9s %23s\n",
+                "scene", "frames", "fps", "Mrays/s", "primary", "shadow", "reflection", "p50 ms", "p99 ms", "prepare/trace/present");
+    for (const auto& r : results) {
+        std::printf("%-12s %7d %9.1f %9.2f %12lld %12lld %12lld %9.3f %9.3f %7.3f/%7.3f/%7.3f\n",
+                    r.name.c_str(), r.frames, r.frames / r.total_time, r.stats.total_rays() / r.total_time / 1e6,
+                    r.stats.primary_rays, r.stats.shadow_rays, r.stats.reflection_rays, r.p50 * 1e3, r.p99 * 1e3,
+                    r.stats.prepare_time / r.frames * 1e3, r.stats.trace_time / r.frames * 1e3, r.stats.present_time / r.frames * 1e3);
+    }
+#ifdef RT_PROFILE
+    std::printf("\nintersection tests per frame, scalar/packet\n%-12s", "scene");
+    for (int k = 0; k < ProfileCounters::num_kinds; ++k) {
+        std::printf(" %17s", ProfileCounters::kind_name(k));
+    }
+    std::printf(" %12s %12s\n", "bvh nodes", "triangles");
+    for (const auto& r : results) {
+        std::printf("%-12s", r.name.c_str());
+        for (int k = 0; k < ProfileCounters::num_kinds; ++k) {
+            std::printf(" %9lld/%7lld", r.counters.intersection_tests[k] / r.frames, r.counters.packet_tests[k] / r.frames);
+        }
+        std::printf(" %12lld %12lld\n", (r.counters.bvh_nodes + r.counters.packet_bvh_nodes) / r.frames, r.counters.triangle_tests / r.frames);
+    }
+#endif
+}
+
+
+bool write_json(const std::string& path, const std::vector<BenchResult>& results, const BenchOptions& options) {
+    FILE* file = std::fopen(path.c_str(), "w");
+    if (!file) return false;
+
+    std::fprintf(file, "{\n  \"width\": %d, \"height\": %d, \"reflections\": %d, \"threads\": %d, \"packet\": %d,\n  \"results\": [\n",
+                 options.width, options.height, options.reflections, options.threads, options.packet);
+    for (size_t k = 0; k < results.size(); ++k) {
+        const auto& r = results[k];
+        std::fprintf(file,
+            "    {\"scene\": \"%s\", \"frames\": %d, \"fps\": %.3f, \"rays_per_second\": %.1f, "
+            "\"primary_rays\": %lld, \"shadow_rays\": %lld, \"reflection_rays\": %lld, \"shadow_cache_hits\": %lld, \"reused_pixels\": %lld, \"skipped_bounces\": %lld, "
+            "\"p50_ms\": %.4f, \"p99_ms\": %.4f, \"prepare_ms\": %.4f, \"trace_ms\": %.4f, \"present_ms\": %.4f}%s\n",
+            r.name.c_str(), r.frames, r.frames / r.total_time, r.stats.total_rays() / r.total_time,
+            r.stats.primary_rays, r.stats.shadow_rays, r.stats.reflection_rays, r.stats.shadow_cache_hits, r.stats.reused_pixels, r.stats.skipped_bounces, r.p50 * 1e3, r.p99 * 1e3,
+            r.stats.prepare_time / r.frames * 1e3, r.stats.trace_time / r.frames * 1e3, r.stats.present_time / r.frames * 1e3,
+            k + 1 < results.size() ? "," : "");
+    }
+    std::fprintf(file, "  ]\n}\n");
+    std::fclose(file);
+    return true;
+}
+
+
+// objects of every kind of objects.h, turned at random, and instances of a cylinder over a chessboard in front of
+// a wall; the engine gets them and the reference copies of them. Returns the pairs of copies of the movable ones.
+std::vector<std::pair<Object*, Object*>> add_verify_objects(RaytracingEngine& engine, ReferenceTracer& reference, int num_objects, unsigned seed) {
+    std::mt19937 rng(seed);
+    const float extent = 1 + std::sqrt(static_cast<float>(num_objects)) * 0.4f;
+    std::uniform_real_distribution<float> position(-extent, extent);
+    std::uniform_real_distribution<float> size(0.1, 0.3);
+    std::uniform_real_distribution<float> coeff(0.2, 1);
+    std::uniform_real_distribution<float> unit(-1, 1);
+    std::uniform_real_distribution<float> angle(0, 2 * M_PI);
+    std::uniform_int_distribution<int> kind(0, 6);
+
+    auto add = [&](auto object) -> std::pair<Object*, Object*> {
+        using T = decltype(object);
+        Object& reference_copy = reference.add_object(std::make_unique<T>(object));
+        return {&engine.scene.add_object(std::move(object)), &reference_copy};
+    };
+    auto random_dir = [&] {
+        Vec3 v;
+        do {
+            v = Vec3(unit(rng), unit(rng), unit(rng));
+        } while (v.norm() < 0.1f || v.norm() > 1);
+        return v.normalized();
+    };
+    auto perpendicular = [&](const Vec3& d) {
+        Vec3 v;
+        do {
+            v = d.cross(random_dir());
+        } while (v.norm() < 0.1f);
+        return v.normalized();
+    };
+    auto cylinder = std::make_shared<Cylinder>(Vec3(0, 0, 0), Vec3(0, -1, 0), 1, 2, 1);
+
+    engine.camera.set_position({0, -extent, -2 * extent});
+    engine.light.set_position({0, -10 * extent, -10 * extent});
+    add(ChessPlane({0, 0, 0}, 0.5, 0.1, 0.3));
+    add(Plane({0, 0, 3 * extent}, {0, 0, -1}, 0.5));
+    std::vector<std::pair<Object*, Object*>> objects;
+    for (int k = 0; k < num_objects; ++k) {
+        Vec3 base(position(rng), -size(rng), position(rng));
+        float s = size(rng);
+        Vec3 d = random_dir();
+        switch (kind(rng)) {
+            case 0: objects.push_back(add(Sphere(base, s, coeff(rng)))); break;
+            case 1: objects.push_back(add(Rect(base, d, perpendicular(d), 2 * s, s, coeff(rng)))); break;
+            case 2: objects.push_back(add(RectPrism(base, d, perpendicular(d), 3 * s, s, 2 * s, coeff(rng)))); break;
+            case 3: objects.push_back(add(Cube(base, d, perpendicular(d), 2 * s, coeff(rng)))); break;
+            case 4: objects.push_back(add(Cylinder(base, d, s, 3 * s, coeff(rng)))); break;
+            case 5: objects.push_back(add(Cone(base, d, s, 3 * s, coeff(rng)))); break;
+            case 6: objects.push_back(add(Instance(cylinder, Vec3(angle(rng), angle(rng), 0), base, s))); break;
+        }
+    }
+    return objects;
+}
+
+
+struct VerifyPath {
+    std::string name;
+    std::function<void(RaytracingEngine&)> configure;
+    int threads = 1;
+    bool exact = true; // false for paths that are approximate by design, reported without failing
+    bool batch = false;
+};
+
+
+struct VerifyResult {
+    long long pixels = 0;
+    long long mismatches = 0;
+    long long grazing = 0; // mismatches explained by the rounding of the camera's ray, not counted above
+    int max_diff = 0;
+    std::string first; // where the first mismatch is
+};
+
+
+// A pixel may differ when its ray grazes an edge, as the camera's rays, built from a cached basis, differ from the
+// reference's by rounding. Such a mismatch, where the camera's ray is within rounding of the reference's and the
+// reference draws the engine's character along it, is counted apart and does not fail the path.
+void compare_frame(const ReferenceTracer& reference, const Camera& camera, const Light& light, const char* expected, const char* actual,
+                   int tolerance, int frame, VerifyResult& result) {
+    const int width = camera.get_width();
+    const int height = camera.get_height();
+    for (int k = 0; k < width * height; ++k) {
+        int diff = std::abs(ReferenceTracer::gradient_index(expected[k]) - ReferenceTracer::gradient_index(actual[k]));
+        if (diff > tolerance) {
+            const Vec3 dir = camera.get_dir_to_pixel(k / width, k % width);
+            if ((dir - ReferenceTracer::dir_to_pixel(camera, k / width, k % width)).norm() < 1e-5f &&
+                reference.trace(camera.get_position(), dir, light) == actual[k]) {
+                ++result.grazing;
+                continue;
+            }
+            if (result.mismatches == 0) {
+                result.first = "frame " + std::to_string(frame) + " pixel (" + std::to_string(k / width) + ", " + std::to_string(k % width) +
+                               "): '" + expected[k] + "' expected, '" + actual[k] + "' drawn";
+            }
+            ++result.mismatches;
+        }
+        result.max_diff = std::max(result.max_diff, diff);
+    }
+    result.pixels += width * height;
+}
+
+
+// renders the scene of the seed through one path and compares every frame with the reference; between frames the
+// camera turns and, except in a batch, where the scene must not change, a few objects move
+void verify_path(const VerifyPath& path, const BenchOptions& options, unsigned seed, VerifyResult& result) {
+    struct FrameSink : public OutputSink {
+        std::vector<std::vector<char>> frames;
+        void present(const char* screen, int width, int height) override {
+            frames.emplace_back(screen, screen + width * height);
+        }
+    };
+
+    const float pixel_aspect = 0.5;
+    RaytracingEngine engine(options.width, options.height, pixel_aspect, options.reflections, path.threads);
+    ReferenceTracer reference(options.reflections);
+    auto objects = add_verify_objects(engine, reference, options.objects, seed);
+    path.configure(engine);
+    const Vec3 turn(0, 0.05, 0);
+    std::vector<char> expected(options.width * options.height);
+
+    if (path.batch) {
+        FrameSink sink;
+        engine.render_batch(options.frames, [turn](Camera& camera, Light&) { camera.rotate_around_origin(turn); }, sink);
+        Camera camera = engine.camera;
+        for (int frame = 0; frame < options.frames; ++frame) {
+            reference.render(camera, engine.light, expected.data());
+            compare_frame(reference, camera, engine.light, expected.data(), sink.frames[frame].data(), options.tolerance, frame, result);
+            camera.rotate_around_origin(turn);
+        }
+        return;
+    }
+
+    const int num_moving = std::min(3, static_cast<int>(objects.size()));
+    for (int frame = 0; frame < options.frames; ++frame) {
+        do {
+            engine.render_frame();
+        } while (!engine.is_refined());
+        reference.render(engine.camera, engine.light, expected.data());
+        compare_frame(reference, engine.camera, engine.light, expected.data(), engine.camera.get_screen(), options.tolerance, frame, result);
+
+        engine.camera.rotate_around_origin(turn);
+        for (int k = 0; k < num_moving; ++k) {
+            Vec3 offset(0.1f * std::cos(frame + k), 0, 0.1f * std::sin(frame + k));
+            engine.scene.move_object(objects[k].first, offset);
+            objects[k].second->translate(offset);
+        }
+    }
+}
+
+
+// largest leaf and depth of a BVH
+std::pair<int, int> bvh_shape(const BVH& bvh) {
+    const auto& nodes = bvh.get_nodes();
+    int largest = 0, depth = 0;
+    std::vector<std::pair<int, int>> stack = {{0, 0}};
+    while (!stack.empty()) {
+        auto [node_index, node_depth] = stack.back();
+        stack.pop_back();
+        depth = std::max(depth, node_depth);
+        if (nodes[node_index].count > 0) {
+            largest = std::max(largest, nodes[node_index].count);
+        } else {
+            stack.push_back({node_index + 1, node_depth + 1});
+            stack.push_back({nodes[node_index].offset, node_depth + 1});
+        }
+    }
+    return {largest, depth};
+}
+
+
+// The builder keeps leaves within BVH::max_leaf_size over random boxes and the depth within BVH::max_depth over
+// boxes growing geometrically, where every level splits off only a few of them; a ray through all of those
+// still finds the nearest box.
+bool check_bvh(const BenchOptions& options) {
+    std::mt19937 rng(options.seed);
+    std::uniform_real_distribution<float> position(-20, 20);
+    std::uniform_real_distribution<float> size(0.1, 0.3);
+    std::vector<AABB> boxes;
+    for (int k = 0; k < 2000; ++k) {
+        Vec3 center(position(rng), position(rng), position(rng));
+        float r = size(rng);
+        boxes.push_back(AABB(center - Vec3(r, r, r), center + Vec3(r, r, r)));
+    }
+    BVH random_bvh;
+    random_bvh.build(boxes);
+    auto random_shape = bvh_shape(random_bvh);
+
+    boxes.clear();
+    for (int k = 0; k < 200; ++k) {
+        float x = std::pow(1.2f, static_cast<float>(k));
+        boxes.push_back(AABB(Vec3(x, -x, -x), Vec3(x * 1.01f, x, x)));
+    }
+    BVH skewed_bvh;
+    skewed_bvh.build(boxes);
+    auto skewed_shape = bvh_shape(skewed_bvh);
+    const Vec3 origin(1e38f, 0, 0), dir(-1, 0, 0), inv_dir(-1, INFINITY, INFINITY);
+    float t_max = INFINITY;
+    int nearest = -1;
+    skewed_bvh.traverse(origin, dir, t_max, [&](int prim) {
+        auto t = boxes[prim].hit(origin, inv_dir, t_max);
+        if (t) {
+            t_max = *t;
+            nearest = prim;
+        }
+        return false;
+    });
+
+    const bool passed = random_shape.first <= BVH::max_leaf_size && skewed_shape.second <= BVH::max_depth && nearest == 199;
+    std::printf("bvh: random boxes - largest leaf %d, depth %d; skewed boxes - depth %d, nearest box %s%s\n\n",
+                random_shape.first, random_shape.second, skewed_shape.second, nearest == 199 ? "found" : "missed",
+                passed ? "" : "  FAILED");
+    return passed;
+}
+
+
+bool verify(const BenchOptions& options) {
+    // the tiled paths run on 4 threads unless --threads asks for others
+    const int threads = options.threads == 1 ? 4 : options.threads;
+    std::vector<VerifyPath> paths = {
+        {"scalar", [](RaytracingEngine&) {}},
+        {"tiles", [](RaytracingEngine&) {}, threads},
+        {"packet4", [](RaytracingEngine& engine) { engine.set_packet_size(4); }},
+        {"packet8", [](RaytracingEngine& engine) { engine.set_packet_size(8); }, threads},
+        {"packet16", [](RaytracingEngine& engine) { engine.set_packet_size(16); }},
+        {"adaptive-depth", [](RaytracingEngine& engine) { engine.set_adaptive_depth(true); }, threads},
+        {"progressive", [](RaytracingEngine& engine) { engine.set_progressive(8, 4000); }},
+        {"batch", [](RaytracingEngine&) {}, threads, true, true},
+        {"progressive-adaptive", [](RaytracingEngine& engine) { engine.set_progressive(8, 4000, true); }, 1, false},
+        {"temporal", [](RaytracingEngine& engine) { engine.set_temporal_reuse(2); }, 1, false},
+    };
+
+    bool passed = check_bvh(options);
+    std::printf("%-22s %12s %12s %9s %9s\n", "path", "pixels", "mismatches", "max diff", "grazing");
+    for (const VerifyPath& path : paths) {
+        VerifyResult result;
+        for (int k = 0; k < options.verify; ++k) {
+            verify_path(path, options, options.seed + k, result);
+        }
+        std::printf("%-22s %12lld %12lld %9d %9lld%s\n", path.name.c_str(), result.pixels, result.mismatches, result.max_diff,
+                    result.grazing, path.exact ? "" : "  (approximate)");
+        if (result.mismatches > 0) {
+            std::printf("    first at %s\n", result.first.c_str());
+            passed = passed && !path.exact;
+        }
+    }
+    return passed;
+}
+
+
+int main(int argc, char** argv) {
+    BenchOptions options;
+    for (int k = 1; k < argc; ++k) {
+        std::string arg = argv[k];
+        if (k + 1 >= argc) {
+            std::fprintf(stderr, "missing value for %s\n", arg.c_str());
+            return 2;
+        }
+        const char* value = argv[++k];
+        if (arg == "--frames") options.frames = std::atoi(value);
+        else if (arg == "--warmup") options.warmup = std::atoi(value);
+        else if (arg == "--width") options.width = std::atoi(value);
+        else if (arg == "--height") options.height = std::atoi(value);
+        else if (arg == "--reflections") options.reflections = std::atoi(value);
+        else if (arg == "--threads") options.threads = std::atoi(value);
+        else if (arg == "--packet") options.packet = std::atoi(value);
+        else if (arg == "--progressive") options.progressive = std::atoi(value);
+        else if (arg == "--budget") options.budget = std::atoll(value);
+        else if (arg == "--adaptive") options.adaptive = std::atoi(value) != 0;
+        else if (arg == "--temporal") options.temporal = std::atoi(value);
+        else if (arg == "--adaptive-depth") options.adaptive_depth = std::atoi(value) != 0;
+        else if (arg == "--target-fps") options.target_fps = static_cast<float>(std::atof(value));
+        else if (arg == "--objects") options.objects = std::atoi(value);
+        else if (arg == "--moving") options.moving = std::atoi(value);
+        else if (arg == "--triangles") options.triangles = std::atoi(value);
+        else if (arg == "--obj") options.obj = value;
+        else if (arg == "--file") options.file = value;
+        else if (arg == "--seed") options.seed = static_cast<unsigned>(std::atoi(value));
+        else if (arg == "--scene") options.scene = value;
+        else if (arg == "--json") options.json = value;
+        else if (arg == "--trace") options.trace = value;
+        else if (arg == "--verify") options.verify = std::atoi(value);
+        else if (arg == "--tolerance") options.tolerance = std::atoi(value);
+        else {
+            std::fprintf(stderr, "unknown option %s\n", arg.c_str());
+            return 2;
+        }
+    }
+    if (options.frames < 0) {
+        std::fprintf(stderr, "--frames must be positive\n");
+        return 2;
+    }
+    if (options.frames == 0) {
+        options.frames = options.verify > 0 ? 4 : 100;
+    }
+    if (options.tolerance < 0) {
+        std::fprintf(stderr, "--tolerance must not be negative\n");
+        return 2;
+    }
+    if (options.target_fps < 0) {
+        std::fprintf(stderr, "--target-fps must not be negative\n");
+        return 2;
+    }
+
+    if (options.verify > 0) {
+        try {
+            return verify(options) ? 0 : 1;
+        } catch (const std::exception& e) {
+            std::fprintf(stderr, "%s\n", e.what());
+            return 1;
+        }
+    }
+
+    std::vector<BenchScene> scenes;
+    try {
+        scenes = make_scenes(options);
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+
+    std::unique_ptr<ChromeTraceWriter> trace;
+    try {
+        if (!options.trace.empty()) trace = std::make_unique<ChromeTraceWriter>(options.trace);
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+
+    std::vector<BenchResult> results;
+    int trace_frame = 0;
+    for (const auto& bench_scene : scenes) {
+        if (!options.scene.empty() && bench_scene.name.rfind(options.scene, 0) != 0) continue;
+        results.push_back(run(bench_scene, options, trace.get(), trace_frame));
+    }
+    if (results.empty()) {
+        std::fprintf(stderr, "unknown scene %s\n", options.scene.c_str());
+        return 2;
+    }
+
+    print_text(results);
+    if (trace) {
+        try {
+            trace->finish();
+        } catch (const std::exception& e) {
+            std::fprintf(stderr, "%s\n", e.what());
+            return 1;
+        }
+    }
+    if (!options.json.empty() && !write_json(options.json, results, options)) {
+        std::fprintf(stderr, "cannot write %s\n", options.json.c_str());
+        return 1;
+    }
+    return 0;
+}
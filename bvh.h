@@ -0,0 +1,334 @@
+#ifndef BVH_H_INCLUDED
+#define BVH_H_INCLUDED
+#include "tools.h"
+#include "profile.h"
+#include <vector>
+#include <algorithm>
+#include <numeric>
+
+
+class BVH {
+// Bounding volume hierarchy over a set of boxes, built with the binned surface area heuristic.
+// Nodes are stored depth-first in one array: the left child of an inner node follows it directly.
+public:
+    struct Node {
+        AABB bounds;
+        int offset; // leaf - first entry in primitive order, inner node - index of the right child
+        int count;  // number of primitives in a leaf, 0 for an inner node
+    };
+
+    // leaves hold at most max_leaf_size primitives unless their centroids coincide or they lie max_depth
+    // levels down; nothing is split deeper, so traversal stacks of max_depth entries never overflow
+    static constexpr int max_leaf_size = 4;
+    static constexpr int max_depth = 64;
+
+private:
+    static constexpr int num_bins = 12;
+    static constexpr float traversal_cost = 1.0;
+    static constexpr float intersection_cost = 2.0;
+
+    std::vector<Node> nodes;
+    std::vector<int> order;
+
+    // kept for refit: the box of every primitive, the parent of every node and the leaf holding every primitive
+    std::vector<AABB> boxes;
+    std::vector<int> parents;
+    std::vector<int> leaf_of;
+    std::vector<int> dirty_leaves;
+    std::vector<char> leaf_dirty;
+
+    // SAH cost of the tree times the surface area of the root, kept up to date by refit
+    float cost_sum = 0;
+    float build_cost = 0;
+
+    struct BuildEntry {
+        AABB bounds;
+        Vec3 centroid;
+    };
+
+    static float axis_value(const Vec3& v, int axis) {
+        return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+    }
+
+    static bool same_bounds(const AABB& a, const AABB& b) {
+        return a.min.x == b.min.x && a.min.y == b.min.y && a.min.z == b.min.z &&
+               a.max.x == b.max.x && a.max.y == b.max.y && a.max.z == b.max.z;
+    }
+
+    float node_cost(const Node& node) const {
+        return (node.count > 0 ? intersection_cost * node.count : traversal_cost) * node.bounds.surface_area();
+    }
+
+    // replaces the bounds of a node and reports whether they changed
+    bool set_bounds(int node_index, const AABB& bounds) {
+        Node& node = nodes[node_index];
+        if (same_bounds(node.bounds, bounds)) return false;
+        cost_sum -= node_cost(node);
+        node.bounds = bounds;
+        cost_sum += node_cost(node);
+        return true;
+    }
+
+    float normalized_cost(float sum) const {
+        return nodes.empty() ? 0 : sum / std::max(nodes[0].bounds.surface_area(), 1e-12f);
+    }
+
+    int build_node(std::vector<BuildEntry>& entries, int begin, int end, int parent, int depth) {
+        int node_index = static_cast<int>(nodes.size());
+        nodes.push_back(Node());
+        parents.push_back(parent);
+
+        AABB bounds, centroid_bounds;
+        for (int i = begin; i < end; ++i) {
+            bounds.expand(entries[order[i]].bounds);
+            centroid_bounds.expand(entries[order[i]].centroid);
+        }
+        nodes[node_index].bounds = bounds;
+
+        int count = end - begin;
+        float leaf_cost = intersection_cost * count;
+        int best_axis = -1;
+        int best_split = 0;
+        float best_cost = INFINITY;
+
+        for (int axis = 0; axis < 3 && count > 1 && depth < max_depth; ++axis) {
+            float lo = axis_value(centroid_bounds.min, axis);
+            float hi = axis_value(centroid_bounds.max, axis);
+            if (hi - lo < 1e-9) continue;
+
+            AABB bin_bounds[num_bins];
+            int bin_counts[num_bins] = {};
+            float scale = num_bins / (hi - lo);
+            for (int i = begin; i < end; ++i) {
+                int b = std::min(num_bins - 1, static_cast<int>((axis_value(entries[order[i]].centroid, axis) - lo) * scale));
+                bin_counts[b]++;
+                bin_bounds[b].expand(entries[order[i]].bounds);
+            }
+
+            float right_area[num_bins];
+            int right_count[num_bins];
+            AABB acc;
+            int n = 0;
+            for (int b = num_bins - 1; b > 0; --b) {
+                acc.expand(bin_bounds[b]);
+                n += bin_counts[b];
+                right_area[b] = acc.surface_area();
+                right_count[b] = n;
+            }
+
+            acc = AABB();
+            n = 0;
+            for (int b = 0; b < num_bins - 1; ++b) {
+                acc.expand(bin_bounds[b]);
+                n += bin_counts[b];
+                if (n == 0 || right_count[b + 1] == 0) continue;
+                float cost = traversal_cost + intersection_cost *
+                    (acc.surface_area() * n + right_area[b + 1] * right_count[b + 1]) / std::max(bounds.surface_area(), 1e-12f);
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_split = b;
+                }
+            }
+        }
+
+        if (best_axis < 0 || (count <= max_leaf_size && best_cost >= leaf_cost)) {
+            nodes[node_index].offset = begin;
+            nodes[node_index].count = count;
+            for (int i = begin; i < end; ++i) {
+                leaf_of[order[i]] = node_index;
+            }
+            return node_index;
+        }
+
+        float lo = axis_value(centroid_bounds.min, best_axis);
+        float scale = num_bins / (axis_value(centroid_bounds.max, best_axis) - lo);
+        int* mid = std::partition(order.data() + begin, order.data() + end, [&](int prim) {
+            int b = std::min(num_bins - 1, static_cast<int>((axis_value(entries[prim].centroid, best_axis) - lo) * scale));
+            return b <= best_split;
+        });
+        int split = static_cast<int>(mid - order.data());
+
+        build_node(entries, begin, split, node_index, depth + 1);
+        int right = build_node(entries, split, end, node_index, depth + 1);
+        nodes[node_index].offset = right;
+        nodes[node_index].count = 0;
+        return node_index;
+    }
+
+public:
+    BVH() {}
+
+    void build(const std::vector<AABB>& new_boxes) {
+        boxes = new_boxes;
+        nodes.clear();
+        parents.clear();
+        dirty_leaves.clear();
+        order.resize(boxes.size());
+        std::iota(order.begin(), order.end(), 0);
+        leaf_of.assign(boxes.size(), -1);
+        cost_sum = 0;
+        build_cost = 0;
+        if (boxes.empty()) return;
+
+        std::vector<BuildEntry> entries(boxes.size());
+        for (size_t i = 0; i < boxes.size(); ++i) {
+            entries[i] = {boxes[i], boxes[i].center()};
+        }
+        nodes.reserve(2 * boxes.size());
+        parents.reserve(2 * boxes.size());
+        build_node(entries, 0, static_cast<int>(boxes.size()), -1, 0);
+        leaf_dirty.assign(nodes.size(), 0);
+
+        for (const Node& node : nodes) {
+            cost_sum += node_cost(node);
+        }
+        build_cost = normalized_cost(cost_sum);
+    }
+
+    // new box of a primitive, applied to the tree by the next refit
+    void update(int prim, const AABB& box) {
+        boxes[prim] = box;
+        int leaf = leaf_of[prim];
+        if (!leaf_dirty[leaf]) {
+            leaf_dirty[leaf] = 1;
+            dirty_leaves.push_back(leaf);
+        }
+    }
+
+    // Recomputes the bounds of the leaves touched by update and of their ancestors, bottom-up. The tree keeps
+    // its topology, so its quality drops as primitives move away from where it was built; see get_cost.
+    void refit() {
+        for (int leaf : dirty_leaves) {
+            leaf_dirty[leaf] = 0;
+            const Node& node = nodes[leaf];
+            AABB bounds;
+            for (int i = node.offset; i < node.offset + node.count; ++i) {
+                bounds.expand(boxes[order[i]]);
+            }
+
+            int node_index = leaf;
+            // an ancestor whose bounds come out the same stops the walk, nothing above it can change either
+            while (set_bounds(node_index, bounds) && parents[node_index] >= 0) {
+                node_index = parents[node_index];
+                bounds = nodes[node_index + 1].bounds;
+                bounds.expand(nodes[nodes[node_index].offset].bounds);
+            }
+        }
+        dirty_leaves.clear();
+    }
+
+    // expected cost of a ray through the tree by the surface area heuristic
+    float get_cost() const {
+        return normalized_cost(cost_sum);
+    }
+
+    // get_cost right after the last build
+    float get_build_cost() const {
+        return build_cost;
+    }
+
+    bool empty() const {
+        return nodes.empty();
+    }
+
+    const std::vector<Node>& get_nodes() const {
+        return nodes;
+    }
+
+    // primitive stored at position i of the leaf order
+    int get_primitive(int i) const {
+        return order[i];
+    }
+
+    // Calls visit(begin, end) for every leaf whose box the ray enters before t_max, nearest boxes first, with the
+    // range of the leaf in primitive order. visit returns true to stop the traversal and may shrink t_max to prune farther boxes.
+    template <class F>
+    bool traverse_leaves(const Vec3& line_point, const Vec3& line_dir, float& t_max, F&& visit) const {
+        if (nodes.empty()) return false;
+
+        Vec3 inv_dir(1 / line_dir.x, 1 / line_dir.y, 1 / line_dir.z);
+        int stack[max_depth];
+        float stack_t[max_depth];
+        int stack_size = 0;
+
+        if (!nodes[0].bounds.hit(line_point, inv_dir, t_max)) return false;
+        int node_index = 0;
+
+        while (true) {
+            const Node& node = nodes[node_index];
+            RT_PROFILE_ADD(bvh_nodes, 1);
+            if (node.count > 0) {
+                if (visit(node.offset, node.offset + node.count)) return true;
+            } else {
+                int left = node_index + 1;
+                int right = node.offset;
+                auto t_left = nodes[left].bounds.hit(line_point, inv_dir, t_max);
+                auto t_right = nodes[right].bounds.hit(line_point, inv_dir, t_max);
+                if (t_left && t_right) {
+                    if (*t_right < *t_left) {
+                        std::swap(left, right);
+                        std::swap(t_left, t_right);
+                    }
+                    stack_t[stack_size] = *t_right;
+                    stack[stack_size++] = right;
+                    node_index = left;
+                    continue;
+                }
+                if (t_left) {
+                    node_index = left;
+                    continue;
+                }
+                if (t_right) {
+                    node_index = right;
+                    continue;
+                }
+            }
+
+            do {
+                if (stack_size == 0) return false;
+                --stack_size;
+            } while (stack_t[stack_size] > t_max);
+            node_index = stack[stack_size];
+        }
+    }
+
+    // traverse_leaves calling visit(primitive) for every primitive of the leaves
+    template <class F>
+    bool traverse(const Vec3& line_point, const Vec3& line_dir, float& t_max, F&& visit) const {
+        return traverse_leaves(line_point, line_dir, t_max, [&](int begin, int end) {
+            for (int i = begin; i < end; ++i) {
+                if (visit(order[i])) return true;
+            }
+            return false;
+        });
+    }
+
+    // calls visit(begin, end) for every leaf whose box, grown by pad, contains the point
+    template <class F>
+    void query_point(const Vec3& point, float pad, F&& visit) const {
+        if (nodes.empty()) return;
+
+        auto contains = [&](const AABB& box) {
+            return point.x >= box.min.x - pad && point.x <= box.max.x + pad &&
+                   point.y >= box.min.y - pad && point.y <= box.max.y + pad &&
+                   point.z >= box.min.z - pad && point.z <= box.max.z + pad;
+        };
+
+        int stack[max_depth + 1];
+        int stack_size = 0;
+        if (contains(nodes[0].bounds)) stack[stack_size++] = 0;
+        while (stack_size > 0) {
+            const Node& node = nodes[stack[--stack_size]];
+            if (node.count > 0) {
+                visit(node.offset, node.offset + node.count);
+                continue;
+            }
+            int left = static_cast<int>(&node - nodes.data()) + 1;
+            if (contains(nodes[left].bounds)) stack[stack_size++] = left;
+            if (contains(nodes[node.offset].bounds)) stack[stack_size++] = node.offset;
+        }
+    }
+};
+
+#endif //BVH_H_INCLUDED
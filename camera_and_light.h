@@ -4,6 +4,7 @@
 #include <stdexcept>
 #include <iostream>
 #include <cmath>
+#include <vector>
 
 
 class Camera {
@@ -11,71 +12,140 @@ private:
     Vec3 position = {0, 0, -1};
     Vec3 direction = {0, 0, 1};
     float camera_distance;
-    char* screen;
-    const int width;
-    const int height;
-    const float aspect;
-    const float pixel_aspect;
+    std::vector<char> screen;
+    int width;
+    int height;
+    float aspect;
+    float pixel_aspect;
+    unsigned revision = 0;
+
+    // basis of the view, recomputed by every mutator: the ray to pixel (i, j) goes along
+    // screen_corner + pixel_down*i + pixel_right*j
+    Vec3 right;
+    Vec3 up;
+    Vec3 screen_corner;
+    Vec3 pixel_right;
+    Vec3 pixel_down;
+
+    friend class ReferenceTracer;
+
+    void update_basis() {
+        right = direction.cross(Vec3(0, 1, 0)).normalized_checked();
+        up = right.cross(direction).normalized();
+        float x_extent = aspect * pixel_aspect;
+        screen_corner = direction.normalized() * camera_distance - right * x_extent - up;
+        pixel_right = right * (2 * x_extent / width);
+        pixel_down = up * (2.0f / height);
+        ++revision;
+    }
 
 public:
     Camera(int width, int height, float pixel_aspect, float fov=90):
         camera_distance(1.0 / std::tan(fov * M_PI / 360.0)),
-        screen(new char[width * height]),
+        screen(width * height),
         width(width), height(height),
         aspect(static_cast<float>(width) / height),
-        pixel_aspect(pixel_aspect) {}
+        pixel_aspect(pixel_aspect) {
+        update_basis();
+    }
 
     Camera(int width, int height, float pixel_aspect, const Vec3& position, float fov=90):
         position(position),
         camera_distance(1.0 / std::tan(fov * M_PI / 360.0)),
-        screen(new char[width * height]),
+        screen(width * height),
         width(width), height(height),
         aspect(static_cast<float>(width) / height),
-        pixel_aspect(pixel_aspect) {}
+        pixel_aspect(pixel_aspect) {
+        update_basis();
+    }
     
     Vec3 get_screen_position() const {
         return position + direction.normalized() * camera_distance;
     }
 
     Vec3 get_dir_to_pixel(int i, int j) const {
-        float y = static_cast<float>(i) / height * 2 - 1;
-        float x = static_cast<float>(j) / width * 2 - 1;
-        x *= aspect * pixel_aspect;
+        Vec3 dir = screen_corner + pixel_down * static_cast<float>(i) + pixel_right * static_cast<float>(j);
+        float n = dir.norm();
+        return Vec3(dir.x / n, dir.y / n, dir.z / n);
+    }
+
+    // get_dir_to_pixel for pixels j_begin..j_end-1 of row i, written to separate x, y and z arrays
+    void get_row_dirs(int i, int j_begin, int j_end, float* dir_x, float* dir_y, float* dir_z) const {
+        const Vec3 row = screen_corner + pixel_down * static_cast<float>(i);
+        const int count = j_end - j_begin;
+        for (int k = 0; k < count; ++k) {
+            float j = static_cast<float>(j_begin + k);
+            dir_x[k] = row.x + pixel_right.x * j;
+            dir_y[k] = row.y + pixel_right.y * j;
+            dir_z[k] = row.z + pixel_right.z * j;
+        }
+        for (int k = 0; k < count; ++k) {
+            float n = std::sqrt(dir_x[k] * dir_x[k] + dir_y[k] * dir_y[k] + dir_z[k] * dir_z[k]);
+            dir_x[k] /= n;
+            dir_y[k] /= n;
+            dir_z[k] /= n;
+        }
+    }
 
-        Vec3 screen_center = get_screen_position();
+    // continuous (i, j) pixel coordinates of a point in front of the camera, the inverse of get_dir_to_pixel
+    std::optional<std::pair<float, float>> project(const Vec3& point) const {
+        Vec3 forward = direction.normalized();
+        Vec3 d = point - position;
+        float depth = d.dot(forward);
+        if (depth < 1e-6) {
+            return std::nullopt;
+        }
 
-        Vec3 right = direction.cross(Vec3(0, 1, 0)).normalized();
-        Vec3 up = right.cross(direction).normalized();
-        Vec3 pixel_point = screen_center + right * x + up * y;
+        float scale = camera_distance / depth;
+        float x = d.dot(right) * scale / (aspect * pixel_aspect);
+        float y = d.dot(up) * scale;
+        return std::make_pair((y + 1) / 2 * height, (x + 1) / 2 * width);
+    }
 
-        return (pixel_point - position).normalized();
+    // new screen size; pixel_aspect is the width to height ratio of the new pixels. The screen is cleared.
+    void resize(int new_width, int new_height, float new_pixel_aspect) {
+        if (new_width <= 0 || new_height <= 0) {
+            throw std::invalid_argument("Screen width and height must be positive");
+        }
+        width = new_width;
+        height = new_height;
+        aspect = static_cast<float>(width) / height;
+        pixel_aspect = new_pixel_aspect;
+        screen.assign(width * height, 0);
+        update_basis();
     }
 
     void set_fov(float fov) {
         camera_distance = 1.0 / std::tan(fov * M_PI / 360.0);
+        update_basis();
     }
 
     void set_position(const Vec3& new_position) {
         position = new_position;
+        update_basis();
     }
 
     void set_direction(const Vec3& new_direction) {
         direction = new_direction;
+        update_basis();
     }
 
     void move(const Vec3& displacement) {
         position += displacement;
+        update_basis();
     }
 
     void rotate(const Vec3& rotation_angles) {
         RotationMat rotation_matrix = RotationMat(rotation_angles);
         direction = (rotation_matrix * direction).normalized();
+        update_basis();
     }
 
     void rotate_around_origin(const Vec3& rotation_angles) {
         RotationMat rotation_matrix = RotationMat(rotation_angles);
         position = (rotation_matrix * position).normalized() * position.norm();
         direction = (-position).normalized();
+        update_basis();
     }
 
     void rotate_around_point(const Vec3& point, const Vec3& rotation_angles) {
@@ -84,6 +154,7 @@ public:
         translated_position = (rotation_matrix * translated_position).normalized() * translated_position.norm();
         position = translated_position + point;
         direction = (-position + point).normalized();
+        update_basis();
     }
 
     char& operator[](size_t index) {
@@ -94,7 +165,20 @@ public:
     }
 
     const char* get_screen() const {
-        return screen;
+        return screen.data();
+    }
+
+    // unchecked access for the renderer, width*height characters
+    char* get_screen() {
+        return screen.data();
+    }
+
+    int get_width() const {
+        return width;
+    }
+
+    int get_height() const {
+        return height;
     }
 
     Vec3 get_position() const {
@@ -105,8 +189,9 @@ public:
         return direction;
     }
 
-    ~Camera() {
-        delete[] screen;
+    // changes whenever the view changes, writes to the screen don't count
+    unsigned get_revision() const {
+        return revision;
     }
 };
 
@@ -116,6 +201,7 @@ class Light {
 private:
     Vec3 position = Vec3(0, -100, -100);
     float power = 1;
+    unsigned revision = 0;
 
 public:
     Light() {}
@@ -123,19 +209,23 @@ public:
 
     void set_position(const Vec3& new_position) {
         position = new_position;
+        ++revision;
     }
 
     void set_power(float new_power) {
         power = new_power;
+        ++revision;
     }
 
     void move(const Vec3& displacement) {
         position += displacement;
+        ++revision;
     }
 
     void rotate_around_origin(const Vec3& rotation_angles) {
         RotationMat rotation_matrix = RotationMat(rotation_angles);
         position = (rotation_matrix * position).normalized() * position.norm();
+        ++revision;
     }
 
     void rotate_around_point(const Vec3& point, const Vec3& rotation_angles) {
@@ -143,6 +233,7 @@ public:
         RotationMat rotation_matrix = RotationMat(rotation_angles);
         translated_position = (rotation_matrix * translated_position).normalized() * translated_position.norm();
         position = translated_position + point;
+        ++revision;
     }
 
     Vec3 get_position() const {
@@ -152,6 +243,10 @@ public:
     float get_power() const {
         return power;
     }
+
+    unsigned get_revision() const {
+        return revision;
+    }
 };
 
 #endif //CAMERA_AND_LIGHT_H_UNCLUDED
\ No newline at end of file
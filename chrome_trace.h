@@ -0,0 +1,94 @@
+#ifndef CHROME_TRACE_H_INCLUDED
+#define CHROME_TRACE_H_INCLUDED
+#include "engine.h"
+#include "profile.h"
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <stdexcept>
+
+
+// Writes frames as Chrome trace events (chrome://tracing, Perfetto): the stages of every frame as duration
+// events on one track, and the ray and intersection counts of the frame as counter events.
+class ChromeTraceWriter {
+private:
+    FILE* file;
+    bool first_event = true;
+    std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+
+    void begin_event() {
+        std::fputs(first_event ? "\n" : ",\n", file);
+        first_event = false;
+    }
+
+    void stage(const char* name, double start_us, double duration_us, int frame) {
+        begin_event();
+        std::fprintf(file, "{\"name\": \"%s\", \"cat\": \"frame\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, "
+                           "\"pid\": 1, \"tid\": 1, \"args\": {\"frame\": %d}}", name, start_us, duration_us, frame);
+    }
+
+    void counter_by_kind(const char* name, double ts_us, const long long* counts) {
+        begin_event();
+        std::fprintf(file, "{\"name\": \"%s\", \"ph\": \"C\", \"ts\": %.3f, \"pid\": 1, \"args\": {", name, ts_us);
+        for (int k = 0; k < ProfileCounters::num_kinds; ++k) {
+            std::fprintf(file, "%s\"%s\": %lld", k > 0 ? ", " : "", ProfileCounters::kind_name(k), counts[k]);
+        }
+        std::fputs("}}", file);
+    }
+
+public:
+    explicit ChromeTraceWriter(const std::string& path) {
+        file = std::fopen(path.c_str(), "w");
+        if (!file) {
+            throw std::runtime_error("Cannot open " + path);
+        }
+        std::fputs("{\"displayTimeUnit\": \"ms\", \"traceEvents\": [", file);
+    }
+
+    ChromeTraceWriter(const ChromeTraceWriter&) = delete;
+    ChromeTraceWriter& operator=(const ChromeTraceWriter&) = delete;
+
+    // start is the time render_frame was called, the stages follow one another from there
+    void add_frame(int frame, std::chrono::steady_clock::time_point start, const FrameStats& stats, const ProfileCounters& counters) {
+        const double us = 1e6;
+        const double start_us = std::chrono::duration<double>(start - origin).count() * us;
+        double t = start_us;
+        stage("prepare", t, stats.prepare_time * us, frame);
+        t += stats.prepare_time * us;
+        stage("trace", t, stats.trace_time * us, frame);
+        t += stats.trace_time * us;
+        stage("present", t, stats.present_time * us, frame);
+
+        begin_event();
+        std::fprintf(file, "{\"name\": \"rays\", \"ph\": \"C\", \"ts\": %.3f, \"pid\": 1, \"args\": "
+                           "{\"primary\": %lld, \"shadow\": %lld, \"reflection\": %lld}}",
+                     start_us, stats.primary_rays, stats.shadow_rays, stats.reflection_rays);
+        counter_by_kind("intersection tests", start_us, counters.intersection_tests);
+        counter_by_kind("packet tests", start_us, counters.packet_tests);
+        begin_event();
+        std::fprintf(file, "{\"name\": \"traversal\", \"ph\": \"C\", \"ts\": %.3f, \"pid\": 1, \"args\": "
+                           "{\"bvh_nodes\": %lld, \"packet_bvh_nodes\": %lld, \"triangle_tests\": %lld, \"hint_tests\": %lld}}",
+                     start_us, counters.bvh_nodes, counters.packet_bvh_nodes, counters.triangle_tests, counters.hint_tests);
+    }
+
+    // ends the JSON document and closes the file
+    void finish() {
+        if (!file) return;
+        std::fputs("\n]}\n", file);
+        int result = std::fclose(file);
+        file = nullptr;
+        if (result != 0) {
+            throw std::runtime_error("Cannot write trace");
+        }
+    }
+
+    ~ChromeTraceWriter() {
+        try {
+            finish();
+        } catch (const std::exception&) {
+            // a destructor can't report it, call finish() to know
+        }
+    }
+};
+
+#endif //CHROME_TRACE_H_INCLUDED
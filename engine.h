@@ -3,75 +3,759 @@
 #include "scene.h"
 #include "objects.h"
 #include "camera_and_light.h"
+#include "thread_pool.h"
+#include "output_sink.h"
+#include "profile.h"
 #include <iostream>
-#include <windows.h>
-#include <wchar.h>
+#include <memory>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+
+
+struct FrameStats {
+    long long primary_rays = 0;
+    long long shadow_rays = 0;
+    long long reflection_rays = 0;
+    long long shadow_cache_hits = 0; // shadow rays answered by the occluder cached for the pixel
+    long long reused_pixels = 0;     // pixels that took their character from the previous frame
+    long long skipped_bounces = 0;   // bounces adaptive depth left out because they couldn't change the character
+    double prepare_time = 0; // seconds
+    double trace_time = 0;
+    double present_time = 0;
+
+    FrameStats& operator+=(const FrameStats& other) {
+        primary_rays += other.primary_rays;
+        shadow_rays += other.shadow_rays;
+        reflection_rays += other.reflection_rays;
+        shadow_cache_hits += other.shadow_cache_hits;
+        reused_pixels += other.reused_pixels;
+        skipped_bounces += other.skipped_bounces;
+        prepare_time += other.prepare_time;
+        trace_time += other.trace_time;
+        present_time += other.present_time;
+        return *this;
+    }
+
+    long long total_rays() const {
+        return primary_rays + shadow_rays + reflection_rays;
+    }
+};
 
 
 class RaytracingEngine {
 private:
-    const int width;
-    const int height;
-    const int num_reflections;
+    // resolution frames are traced at, the camera's; lower than the output's while the governor scales it down
+    int width;
+    int height;
+    const int max_reflections;
+    int num_reflections; // bounces traced, max_reflections unless the governor lowered it
+
+    static constexpr int tile_width = 16;
+    static constexpr int tile_height = 8;
+    ThreadPool pool;
+    int packet_size = 0;
+
+    std::unique_ptr<OutputSink> output;
+    int output_width;
+    int output_height;
+    float pixel_aspect;
+    std::vector<char> upscaled; // traced frame stretched to the output size
+
+    FrameStats frame_stats;
+    std::mutex stats_mutex;
+    ProfileCounters profile_counters;
+
+    // heatmap mode: the time every pixel took replaces its character
+    bool heatmap = false;
+    std::vector<float> pixel_cost; // seconds
+    std::vector<float> sorted_cost;
+
+    // last occluder found for every pixel and bounce, tried first by the next shadow ray there;
+    // each pixel belongs to one tile, so the threads never share an entry
+    std::vector<const Object*> shadow_cache;
+    unsigned shadow_cache_revision = 0;
 
-    HANDLE hConsole;
-    DWORD dwBytesWritten;
+    // progressive mode: pixels on a grid whose step halves from progressive_block down to 1 are traced
+    // level by level, each one filling its step x step block until finer levels overwrite it
+    int progressive_block = 0;
+    long long ray_budget = 0;
+    bool adaptive = false;
+    int level_step = 0; // step of the level being traced, 0 once the image is refined
+    int level_row = 0;  // next row of that level
+    unsigned camera_revision = 0;
+    unsigned light_revision = 0;
+    unsigned scene_revision = 0;
+
+    // temporal reuse: the primary hit of every pixel is kept with its character, the next frame reprojects
+    // the hits into the new view and reuses the character where a pixel sees the same surface at the same depth
+    struct TemporalSample {
+        Vec3 point;
+        const Object* object = nullptr; // nullptr - no sample
+        float reflection_coeff = 0;
+        char value = ' ';
+        int age = 0; // frames the value has been reused for
+    };
+
+    int max_reuse_age = 0;
+    float max_reuse_offset = 0;
+    std::vector<TemporalSample> samples;      // previous frame
+    std::vector<TemporalSample> next_samples; // frame being rendered
+    std::vector<int> reprojected;             // previous sample landing on each pixel, -1 for none
+    std::vector<float> reprojected_depth;
+    unsigned samples_light_revision = 0;
+    unsigned samples_scene_revision = 0;
+
+    // frame-rate governor: quality levels go from the full resolution and depth down to the lowest allowed;
+    // the level is lowered when the smoothed trace time stays over the frame budget and raised only when the
+    // higher level is expected to fit well within it for a while, so quality doesn't flip between two levels
+    struct QualityLevel {
+        float scale; // of the output width and height
+        int reflections;
+    };
+
+    std::vector<QualityLevel> quality_levels = {{1, 0}};
+    int quality = 0;
+    double frame_budget = 0; // seconds, 0 - governor off
+    double smoothed_time = 0;
+    int frames_over = 0;
+    int frames_under = 0;
+    int settle_frames = 0;   // frames after a change whose times only seed smoothed_time
 
     static constexpr char gradient[] = " .:!/r(l1Z4H9W8$@";
     static constexpr int gradient_size = sizeof(gradient) - 1;
 
+    // adaptive depth: remaining_gain[m] bounds what m more bounces can add to the intensity per unit of the
+    // reflection coefficient so far and of light power, c + c^2 + ... + c^m for the largest coefficient c
+    bool adaptive_depth = false;
+    std::vector<float> remaining_gain;
+
+    static int gradient_index(float intensity) {
+        const float max_intensity = 1;
+        return std::min(static_cast<int>(intensity/max_intensity*gradient_size), gradient_size - 1);
+    }
+
+    void update_remaining_gain() {
+        const float c = scene.get_max_reflection_coeff();
+        remaining_gain.assign(num_reflections, 0);
+        float power = 1;
+        for(int m=1; m<num_reflections; ++m) {
+            power *= c;
+            remaining_gain[m] = remaining_gain[m - 1] + power;
+        }
+    }
+
+    // whether no intensity in [intensity, intensity + bound] maps to another character; the bound is padded
+    // for rounding, so stopping there gives the same character as tracing on
+    bool is_settled(float intensity, float bound) const {
+        return gradient_index(intensity) == gradient_index(intensity + bound * 1.001f + 1e-6f);
+    }
+
+    // what a frame is seen through and drawn into: the engine's own camera and light, or the copies of a batch frame
+    struct View {
+        Camera& camera;
+        const Light& light;
+        const Object** shadow_cache; // max_reflections entries per pixel
+        bool temporal;               // whether the temporal samples belong to this view
+        float* pixel_cost;           // time of every pixel for the heatmap, nullptr when it isn't drawn
+    };
+
+    View own_view() {
+        return {camera, light, shadow_cache.data(), max_reuse_age > 0, heatmap ? pixel_cost.data() : nullptr};
+    }
+
+    char shade(const View& view, int pixel, Vec3 ray_dir, std::optional<HitRecord> primary_hit, FrameStats& stats) {
+        const Light& light = view.light;
+        const bool can_stop = adaptive_depth && std::isfinite(scene.get_max_reflection_coeff());
+        float light_intensity = 0;
+        float cum_reflection_coeff = 1;
+        Vec3 ray_point = view.camera.get_position();
+        Object* excluded_obj = nullptr;
+        auto hit = primary_hit;
+        stats.primary_rays++;
+
+        for(int k=0; k<num_reflections; ++k) {
+            if (k > 0) {
+                hit = scene.get_nearest_hit(ray_point, ray_dir, excluded_obj);
+                stats.reflection_rays++;
+            }
+
+            if (hit) {
+                // the hit point, normal and reflection coefficient are only evaluated for the nearest object
+                Object* intersection_obj = hit->object;
+                Vec3 intersection = ray_point + ray_dir * hit->t;
+                Vec3 norm_dir = ObjectStore::norm_dir(hit->get_ref(), intersection);
+
+                Vec3 dir_to_light = (light.get_position() - intersection).normalized();
+                float cos_angle = norm_dir.dot(dir_to_light);
+
+                cum_reflection_coeff *= ObjectStore::get_reflection_coeff(hit->get_ref(), intersection);
+
+                // this bounce adds at most cum_reflection_coeff*power, the later ones remaining_gain times that
+                if (can_stop && is_settled(light_intensity, cum_reflection_coeff*light.get_power()*(1 + remaining_gain[num_reflections - 1 - k]))) {
+                    stats.skipped_bounces += num_reflections - 1 - k;
+                    break;
+                }
+
+                if (cos_angle > 0) {
+                    stats.shadow_rays++;
+                    const Object*& cached_occluder = view.shadow_cache[pixel*max_reflections + k];
+                    const Object* occluder = scene.get_occluder(intersection, dir_to_light, intersection_obj, (light.get_position() - intersection).norm(), cached_occluder);
+                    if (occluder && occluder == cached_occluder) {
+                        stats.shadow_cache_hits++;
+                    }
+                    cached_occluder = occluder;
+                    if (!occluder) {
+                        light_intensity += cum_reflection_coeff*cos_angle*light.get_power();
+                    }
+                }
+
+                if (can_stop && k + 1 < num_reflections &&
+                    is_settled(light_intensity, cum_reflection_coeff*light.get_power()*remaining_gain[num_reflections - 1 - k])) {
+                    stats.skipped_bounces += num_reflections - 1 - k;
+                    break;
+                }
+
+                ray_point = intersection;
+                ray_dir = (ray_dir - norm_dir*2*ray_dir.dot(norm_dir)).normalized();
+                excluded_obj = intersection_obj;
+            } else {
+                break;
+            }
+        }
+
+        return gradient[gradient_index(light_intensity)];
+    }
+
+    // shade, or the character of the previous frame's sample reprojected onto the pixel when it is still valid
+    char shade_primary(const View& view, int pixel, const Vec3& ray_dir, const std::optional<HitRecord>& hit, FrameStats& stats) {
+        if (!view.temporal || !hit) {
+            return shade(view, pixel, ray_dir, hit, stats);
+        }
+
+        Vec3 point = camera.get_position() + ray_dir * hit->t;
+        float reflection_coeff = ObjectStore::get_reflection_coeff(hit->get_ref(), point);
+        TemporalSample& sample = next_samples[pixel];
+        int prev = reprojected[pixel];
+        if (prev >= 0) {
+            const TemporalSample& old = samples[prev];
+            if (old.object == hit->object && old.reflection_coeff == reflection_coeff && old.age < max_reuse_age
+                && fabs(reprojected_depth[pixel] - hit->t) <= 0.01f * hit->t) {
+                stats.primary_rays++;
+                stats.reused_pixels++;
+                sample = {point, hit->object, reflection_coeff, old.value, old.age + 1};
+                return old.value;
+            }
+        }
+
+        char value = shade(view, pixel, ray_dir, hit, stats);
+        sample = {point, hit->object, reflection_coeff, value, 0};
+        return value;
+    }
+
+    // moves the samples of the previous frame to the pixels where the current camera sees their points
+    void reproject_samples() {
+        const size_t num_pixels = width*height;
+        if (samples.size() != num_pixels || light.get_revision() != samples_light_revision || scene.get_revision() != samples_scene_revision) {
+            samples.assign(num_pixels, TemporalSample());
+            samples_light_revision = light.get_revision();
+            samples_scene_revision = scene.get_revision();
+        }
+        next_samples.assign(num_pixels, TemporalSample());
+        reprojected.assign(num_pixels, -1);
+        reprojected_depth.assign(num_pixels, INFINITY);
+
+        for(size_t k=0; k<num_pixels; ++k) {
+            if (!samples[k].object) continue;
+            auto coords = camera.project(samples[k].point);
+            if (!coords) continue;
+            int i = static_cast<int>(std::lround(coords->first));
+            int j = static_cast<int>(std::lround(coords->second));
+            if (i < 0 || i >= height || j < 0 || j >= width) continue;
+            if (fabs(coords->first - i) > max_reuse_offset || fabs(coords->second - j) > max_reuse_offset) continue;
+            float depth = (samples[k].point - camera.get_position()).norm();
+            if (depth < reprojected_depth[i*width + j]) {
+                reprojected_depth[i*width + j] = depth;
+                reprojected[i*width + j] = static_cast<int>(k);
+            }
+        }
+    }
+
+    char render_pixel(int i, int j, FrameStats& stats) {
+        Vec3 ray_dir = camera.get_dir_to_pixel(i, j);
+        return shade_primary(own_view(), i*width + j, ray_dir, scene.get_nearest_hit(camera.get_position(), ray_dir), stats);
+    }
+
+    // row ray directions come from the camera in batches, traced in packets when packet_size is set
+    void render_span(const View& view, int i, int j_begin, int j_end, FrameStats& stats) {
+        Camera& camera = view.camera;
+        char* screen = camera.get_screen();
+        if (view.pixel_cost) {
+            // one ray at a time, so that the time of a pixel includes its primary ray
+            for(int j=j_begin; j<j_end; ++j) {
+                auto start = std::chrono::steady_clock::now();
+                Vec3 ray_dir = camera.get_dir_to_pixel(i, j);
+                screen[i*width + j] = shade_primary(view, i*width + j, ray_dir, scene.get_nearest_hit(camera.get_position(), ray_dir), stats);
+                view.pixel_cost[i*width + j] = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+            }
+            return;
+        }
+        RayPacket packet;
+        std::optional<HitRecord> hits[RayPacket::max_size];
+        const int batch_size = packet_size > 0 ? packet_size : RayPacket::max_size;
+        packet.origin = camera.get_position();
+        for(int j0=j_begin; j0<j_end; j0+=batch_size) {
+            packet.size = std::min(batch_size, j_end - j0);
+            camera.get_row_dirs(i, j0, j0 + packet.size, packet.dir_x, packet.dir_y, packet.dir_z);
+            if (packet_size > 0) {
+                scene.get_nearest_hits(packet, hits);
+            } else {
+                for(int k=0; k<packet.size; ++k) {
+                    hits[k] = scene.get_nearest_hit(packet.origin, packet.get_dir(k));
+                }
+            }
+            for(int k=0; k<packet.size; ++k) {
+                screen[i*width + j0 + k] = shade_primary(view, i*width + j0 + k, packet.get_dir(k), hits[k], stats);
+            }
+        }
+    }
+
+    // whether the corners of the coarser cell around (i, j), traced on the previous level, all show the same character
+    bool is_flat(int i, int j, int step) {
+        const int cell = 2*step;
+        const int i0 = i / cell * cell;
+        const int j0 = j / cell * cell;
+        const char* screen = camera.get_screen();
+        const char c = screen[i0*width + j0];
+        for (int i1 : {i0, i0 + cell}) {
+            for (int j1 : {j0, j0 + cell}) {
+                if (i1 < height && j1 < width && screen[i1*width + j1] != c) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    // traces the pixels of row i that are new on the level with the given step; blocks of different rows never overlap
+    void render_level_row(int i, int step, FrameStats& stats) {
+        const bool coarsest = step == progressive_block;
+        const bool on_coarser_row = !coarsest && i % (2*step) == 0;
+        const int j_first = on_coarser_row ? step : 0;
+        const int j_step = on_coarser_row ? 2*step : step;
+        char* screen = camera.get_screen();
+
+        for(int j=j_first; j<width; j+=j_step) {
+            if (adaptive && !coarsest && is_flat(i, j, step)) {
+                continue;
+            }
+            char c = render_pixel(i, j, stats);
+            for(int i1=i; i1<std::min(i + step, height); ++i1) {
+                for(int j1=j; j1<std::min(j + step, width); ++j1) {
+                    screen[i1*width + j1] = c;
+                }
+            }
+        }
+    }
+
+    void render_progressive() {
+        if (camera.get_revision() != camera_revision || light.get_revision() != light_revision || scene.get_revision() != scene_revision) {
+            camera_revision = camera.get_revision();
+            light_revision = light.get_revision();
+            scene_revision = scene.get_revision();
+            level_step = progressive_block;
+            level_row = 0;
+        }
+
+        // the coarsest level is always finished, the finer ones only while the budget lasts: whole rows that fit
+        // in what is left of it, but at least one row per frame so that a budget below a row still refines
+        long long refined_from = frame_stats.primary_rays;
+        bool refined = false;
+        while (level_step > 0) {
+            const bool coarsest = level_step == progressive_block;
+            const int rows_left = (height - level_row + level_step - 1) / level_step;
+            int num_rows = rows_left;
+            if (!coarsest && ray_budget > 0) {
+                long long budget_left = ray_budget - (frame_stats.primary_rays - refined_from);
+                long long row_rays = width / level_step + 1;
+                num_rows = static_cast<int>(std::min<long long>(rows_left, budget_left / row_rays));
+                if (num_rows <= 0) {
+                    if (refined) break;
+                    num_rows = 1;
+                }
+                refined = true;
+            }
+
+            const int first_row = level_row;
+            const int step = level_step;
+            if (pool.size() > 1) {
+                pool.parallel_for(num_rows, [this, first_row, step](int r) {
+                    FrameStats row_stats;
+                    render_level_row(first_row + r*step, step, row_stats);
+                    std::lock_guard<std::mutex> lock(stats_mutex);
+                    frame_stats += row_stats;
+                });
+            } else {
+                for(int r=0; r<num_rows; ++r) {
+                    render_level_row(first_row + r*step, step, frame_stats);
+                }
+            }
+
+            if (coarsest) {
+                refined_from = frame_stats.primary_rays;
+            }
+            level_row += num_rows * step;
+            if (level_row >= height) {
+                level_step /= 2;
+                level_row = 0;
+            }
+        }
+    }
+
+    void render_tile(int tile) {
+        const int tiles_x = (width + tile_width - 1) / tile_width;
+        const int i0 = tile / tiles_x * tile_height;
+        const int j0 = tile % tiles_x * tile_width;
+        FrameStats tile_stats;
+        for(int i=i0; i<std::min(i0 + tile_height, height); ++i) {
+            render_span(own_view(), i, j0, std::min(j0 + tile_width, width), tile_stats);
+        }
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        frame_stats += tile_stats;
+    }
+
+    // draws the pixel times over the gradient, which spans up to the 99th percentile so a few slow pixels
+    // don't flatten the rest
+    void draw_heatmap() {
+        const size_t num_pixels = width*height;
+        sorted_cost.assign(pixel_cost.begin(), pixel_cost.begin() + num_pixels);
+        auto top = sorted_cost.begin() + num_pixels*99/100;
+        std::nth_element(sorted_cost.begin(), top, sorted_cost.end());
+        const float scale = gradient_size / std::max(*top, 1e-9f);
+        char* screen = camera.get_screen();
+        for(size_t k=0; k<num_pixels; ++k) {
+            screen[k] = gradient[std::min(static_cast<int>(pixel_cost[k]*scale), gradient_size - 1)];
+        }
+    }
+
+    // the traced frame as the output gets it, stretched to the output size when it was traced smaller
+    const char* output_frame(const char* screen) {
+        if (width == output_width && height == output_height) {
+            return screen;
+        }
+        upscaled.resize(output_width*output_height);
+        for(int i=0; i<output_height; ++i) {
+            const char* row = screen + i*height/output_height*width;
+            for(int j=0; j<output_width; ++j) {
+                upscaled[i*output_width + j] = row[j*width/output_width];
+            }
+        }
+        return upscaled.data();
+    }
+
+    // reallocates the buffers for another traced resolution; the camera keeps the view of the output
+    void set_trace_size(int new_width, int new_height) {
+        width = new_width;
+        height = new_height;
+        camera.resize(width, height, pixel_aspect * output_width * height / (static_cast<float>(output_height) * width));
+        shadow_cache.clear();
+        samples.clear();
+        level_step = progressive_block;
+        level_row = 0;
+    }
+
+    void set_quality(int level, bool resized = false) {
+        quality = level;
+        const QualityLevel& q = quality_levels[level];
+        num_reflections = q.reflections;
+        const int new_width = std::max(1, static_cast<int>(std::lround(output_width*q.scale)));
+        const int new_height = std::max(1, static_cast<int>(std::lround(output_height*q.scale)));
+        if (resized || new_width != width || new_height != height) {
+            set_trace_size(new_width, new_height);
+        }
+        settle_frames = 2;
+        frames_over = 0;
+        frames_under = 0;
+    }
+
+    // rough cost of level a relative to level b: rays grow with the pixels and with the bounces
+    double cost_ratio(int a, int b) const {
+        const QualityLevel& qa = quality_levels[a];
+        const QualityLevel& qb = quality_levels[b];
+        return qa.scale*qa.scale*(qa.reflections + 1) / (qb.scale*qb.scale*(qb.reflections + 1));
+    }
+
+    void govern(double frame_time) {
+        if (settle_frames > 0) {
+            --settle_frames;
+            smoothed_time = frame_time;
+            return;
+        }
+        smoothed_time += (frame_time - smoothed_time) * 0.25;
+
+        const int lowest = static_cast<int>(quality_levels.size()) - 1;
+        if (smoothed_time > frame_budget) {
+            frames_under = 0;
+            if (++frames_over >= 2 && quality < lowest) {
+                set_quality(quality + 1);
+            }
+        } else if (quality > 0 && smoothed_time * cost_ratio(quality - 1, quality) < 0.8 * frame_budget) {
+            frames_over = 0;
+            if (++frames_under >= 10) {
+                set_quality(quality - 1);
+            }
+        } else {
+            frames_over = 0;
+            frames_under = 0;
+        }
+    }
+
 public:
     Camera camera;
     Light light;
     Scene scene;
 
-    RaytracingEngine(int width, int height, float pixel_aspect, int num_reflections=5):
-        width(width), height(height), num_reflections(num_reflections), camera(width, height, pixel_aspect) {
-            hConsole = CreateConsoleScreenBuffer(GENERIC_READ | GENERIC_WRITE, 0, NULL, CONSOLE_TEXTMODE_BUFFER, NULL);
-            SetConsoleActiveScreenBuffer(hConsole);
-            dwBytesWritten = 0;
+    // num_threads > 1 renders the frame in tiles on a work-stealing pool, 0 uses every hardware core
+    RaytracingEngine(int width, int height, float pixel_aspect, int num_reflections=5, int num_threads=1):
+        width(width), height(height), max_reflections(num_reflections), num_reflections(num_reflections), pool(num_threads), output(new NullSink()),
+        output_width(width), output_height(height), pixel_aspect(pixel_aspect), camera(width, height, pixel_aspect) {
+        quality_levels[0].reflections = num_reflections;
+    }
+
+    // frames are rendered headless until a sink is set, see terminal_sink.h for the console ones
+    void set_output_sink(std::unique_ptr<OutputSink> sink) {
+        output = sink ? std::move(sink) : std::make_unique<NullSink>();
+    }
+
+    // 0 traces primary rays one by one, 4, 8 or 16 traces them in packets of neighbouring pixels
+    void set_packet_size(int size) {
+        if (size != 0 && size != 4 && size != 8 && size != 16) {
+            throw std::invalid_argument("Packet size must be 0, 4, 8 or 16");
+        }
+        packet_size = size;
+    }
+
+    // Progressive mode for interactive motion: after the camera, the light or the scene changes the next frame
+    // traces one pixel per block_size x block_size block (a power of two) and later frames refine it.
+    // ray_budget > 0 caps the pixels traced per frame after the coarse level, in whole rows but at least one;
+    // adaptive skips the pixels whose coarser neighbours all show the same character. block_size 0 turns the mode off.
+    void set_progressive(int block_size, long long ray_budget = 0, bool adaptive = false) {
+        if (block_size < 0 || block_size > 64 || (block_size & (block_size - 1)) != 0) {
+            throw std::invalid_argument("Block size must be 0 or a power of two up to 64");
+        }
+        progressive_block = block_size;
+        this->ray_budget = ray_budget;
+        this->adaptive = adaptive;
+        level_step = block_size;
+        level_row = 0;
+    }
+
+    // Reuses the character of a pixel from the previous frame when its primary ray hits the same object at the
+    // same depth and reflection coefficient as a previous sample reprojected within max_offset pixels of it,
+    // for at most max_age frames in a row. Reflections depend on the view, so this trades some accuracy
+    // for speed, more with larger values; max_age 0 turns it off.
+    void set_temporal_reuse(int max_age, float max_offset = 0.25) {
+        if (max_age < 0 || max_offset < 0 || max_offset > 0.5) {
+            throw std::invalid_argument("Maximum reuse age must be non-negative and maximum offset in [0, 0.5]");
+        }
+        max_reuse_age = max_age;
+        max_reuse_offset = max_offset;
+        samples.clear();
+    }
+
+    // Stops the bounces of a pixel once the most the remaining ones could add, bounded by the largest reflection
+    // coefficient in the scene, can't move it to another character. The image stays the same, so num_reflections
+    // can be raised at little cost. Scenes with objects that don't report max_reflection_coeff trace every bounce.
+    void set_adaptive_depth(bool enabled) {
+        adaptive_depth = enabled;
+    }
+
+    // Frame-rate governor: keeps the time spent preparing and tracing a frame within 1/fps by lowering the
+    // traced resolution, down to min_scale of the output's, and the reflection depth, down to min_reflections,
+    // one step at a time; frames traced smaller are stretched to the output size. Presenting isn't counted, as
+    // the resolution doesn't change it (see async_sink.h to overlap it with tracing). fps 0 turns it off.
+    void set_target_fps(float fps, float min_scale = 0.25, int min_reflections = 1) {
+        if (fps < 0 || !(min_scale > 0 && min_scale <= 1) || min_reflections < 1 || min_reflections > max_reflections) {
+            throw std::invalid_argument("Target frame rate must be non-negative, minimum scale in (0, 1] "
+                                        "and minimum reflections between 1 and the engine's");
+        }
+        frame_budget = fps > 0 ? 1 / fps : 0;
+        // lower the depth and the resolution in turn, so neither goes to its minimum before the other one moves
+        quality_levels = {{1, max_reflections}};
+        while (true) {
+            QualityLevel q = quality_levels.back();
+            const bool can_scale = q.scale > min_scale;
+            const bool can_drop_depth = q.reflections > min_reflections;
+            if (!can_scale && !can_drop_depth) break;
+            if (can_drop_depth && (!can_scale || quality_levels.size() % 2 == 1)) {
+                --q.reflections;
+            } else {
+                q.scale = std::fmax(min_scale, q.scale * 0.8f);
+            }
+            quality_levels.push_back(q);
+        }
+        set_quality(0);
+    }
+
+    // new output size, for a resized terminal; the buffers are reallocated and the governor keeps its level
+    void resize(int new_width, int new_height) {
+        if (new_width <= 0 || new_height <= 0) {
+            throw std::invalid_argument("Width and height must be positive");
+        }
+        output_width = new_width;
+        output_height = new_height;
+        set_quality(quality, true);
+    }
+
+    // output size, the frames given to the sink
+    int get_width() const {
+        return output_width;
+    }
+
+    int get_height() const {
+        return output_height;
+    }
+
+    // resolution and depth frames are traced with, lowered by the governor
+    int get_trace_width() const {
+        return width;
+    }
+
+    int get_trace_height() const {
+        return height;
+    }
+
+    int get_num_reflections() const {
+        return num_reflections;
+    }
+
+    // Heatmap mode: draws how long every pixel took to trace and shade, from ' ' for the fastest to '@' for the
+    // slowest, instead of the image. Pixels are traced one ray at a time and progressive mode is paused.
+    void set_heatmap(bool enabled) {
+        heatmap = enabled;
+    }
+
+    // false while a progressive image is still being refined
+    bool is_refined() const {
+        return progressive_block == 0 || level_step == 0;
     }
 
     void render_frame() {
-        for(int i=0; i<height; ++i) {
-            for(int j=0; j<width; ++j) {
-                float max_intensity = 1;
-                float light_intensity = 0;
-                float cum_reflection_coeff = 1;
-                Vec3 ray_point = camera.get_position();
-                Vec3 ray_dir = camera.get_dir_to_pixel(i, j);
-                Object* excluded_obj = nullptr;
-                
-                for(int k=0; k<num_reflections; ++k) {
-                    auto intersection_and_norm = scene.get_nearest_intersection(ray_point, ray_dir, excluded_obj);
-
-                    if (intersection_and_norm) {
-                        Vec3 intersection = std::get<0>(intersection_and_norm.value());
-                        Vec3 norm_dir = std::get<1>(intersection_and_norm.value());
-                        Object* intersection_obj = std::get<2>(intersection_and_norm.value());
-
-                        Vec3 dir_to_light = (light.get_position() - intersection).normalized();
-                        float cos_angle = norm_dir.dot(dir_to_light);
-
-                        cum_reflection_coeff *= intersection_obj->get_reflection_coeff(intersection);
-
-                        if (cos_angle > 0 && !scene.is_shadow(intersection, dir_to_light, intersection_obj, (light.get_position() - intersection).norm())) {
-                            light_intensity += cum_reflection_coeff*cos_angle*light.get_power();
-                        }
-
-                        ray_point = intersection;
-                        ray_dir = (ray_dir - norm_dir*2*ray_dir.dot(norm_dir)).normalized();
-                        excluded_obj = intersection_obj;
-                    } else {
-                        break;
-                    }
+        using clock = std::chrono::steady_clock;
+        frame_stats = FrameStats();
+
+        auto start = clock::now();
+        scene.prepare();
+        update_remaining_gain();
+        if (shadow_cache.empty() || shadow_cache_revision != scene.get_revision()) {
+            shadow_cache.assign(width*height*max_reflections, nullptr);
+            shadow_cache_revision = scene.get_revision();
+        }
+        if (max_reuse_age > 0) {
+            reproject_samples();
+        }
+        if (heatmap) {
+            pixel_cost.resize(width*height);
+        }
+        auto prepared = clock::now();
+        if (progressive_block > 0 && !heatmap) {
+            render_progressive();
+        } else if (pool.size() > 1) {
+            const int num_tiles = ((width + tile_width - 1) / tile_width) * ((height + tile_height - 1) / tile_height);
+            pool.parallel_for(num_tiles, [this](int tile) { render_tile(tile); });
+        } else {
+            for(int i=0; i<height; ++i) {
+                render_span(own_view(), i, 0, width, frame_stats);
+            }
+        }
+        if (max_reuse_age > 0) {
+            samples.swap(next_samples);
+        }
+        if (heatmap) {
+            draw_heatmap();
+        }
+        profile_counters = Profiler::collect();
+        auto traced = clock::now();
+        output->present(output_frame(camera.get_screen()), output_width, output_height);
+        auto end = clock::now();
+
+        frame_stats.prepare_time = std::chrono::duration<double>(prepared - start).count();
+        frame_stats.trace_time = std::chrono::duration<double>(traced - prepared).count();
+        frame_stats.present_time = std::chrono::duration<double>(end - traced).count();
+        if (frame_budget > 0) {
+            govern(frame_stats.prepare_time + frame_stats.trace_time);
+        }
+    }
+
+    // Renders an animation of num_frames frames for playback and presents them to sink in order. Frames are
+    // traced concurrently, one per thread of the pool, each with its own copy of the camera and the light:
+    // the first frame shows the current view and animate moves the copies on from one frame to the next.
+    // The scene must not change during the batch and the engine's own camera and light are left as they are.
+    // Progressive mode, temporal reuse, the heatmap and the governor don't apply, frames are traced at the current resolution
+    // and depth; returns the ray counts and timings of the whole batch.
+    FrameStats render_batch(int num_frames, const std::function<void(Camera&, Light&)>& animate, OutputSink& sink) {
+        using clock = std::chrono::steady_clock;
+        FrameStats batch_stats;
+        auto start = clock::now();
+        scene.prepare();
+        update_remaining_gain();
+        auto prepared = clock::now();
+        batch_stats.prepare_time = std::chrono::duration<double>(prepared - start).count();
+
+        // two frames per thread in flight keep every thread busy while the finished ones are presented in order
+        const int window = std::max(1, std::min(num_frames, 2 * pool.size()));
+        std::vector<Camera> cameras;
+        std::vector<Light> lights;
+        cameras.reserve(window);
+        lights.reserve(window);
+        std::vector<std::vector<const Object*>> shadow_caches(window, std::vector<const Object*>(width*height*max_reflections, nullptr));
+        std::vector<FrameStats> stats(window);
+
+        Camera next_camera = camera;
+        Light next_light = light;
+        for (int first = 0; first < num_frames; first += window) {
+            const int count = std::min(window, num_frames - first);
+            cameras.clear();
+            lights.clear();
+            for (int k = 0; k < count; ++k) {
+                cameras.push_back(next_camera);
+                lights.push_back(next_light);
+                animate(next_camera, next_light);
+            }
+
+            auto trace_start = clock::now();
+            auto render = [&](int k) {
+                View view = {cameras[k], lights[k], shadow_caches[k].data(), false, nullptr};
+                stats[k] = FrameStats();
+                for (int i = 0; i < height; ++i) {
+                    render_span(view, i, 0, width, stats[k]);
                 }
+            };
+            pool.parallel_for(count, render);
 
-                int idx = std::min(static_cast<int>(light_intensity/max_intensity*gradient_size), gradient_size - 1);
-                camera[i*width + j] = gradient[idx];   
+            auto traced = clock::now();
+            for (int k = 0; k < count; ++k) {
+                sink.present(output_frame(cameras[k].get_screen()), output_width, output_height);
+                batch_stats += stats[k];
             }
+            batch_stats.trace_time += std::chrono::duration<double>(traced - trace_start).count();
+            batch_stats.present_time += std::chrono::duration<double>(clock::now() - traced).count();
         }
-		WriteConsoleOutputCharacter(hConsole, camera.get_screen(), width * height, { 0, 0 }, &dwBytesWritten);
+        profile_counters = Profiler::collect();
+        return batch_stats;
+    }
+
+    // ray counts and stage timings of the last rendered frame
+    const FrameStats& get_frame_stats() const {
+        return frame_stats;
+    }
+
+    // work counters of the last frame, or of the last batch, all 0 unless compiled with RT_PROFILE (see profile.h);
+    // the counters are per process, so they include the work of other engines tracing at the same time
+    const ProfileCounters& get_profile_counters() const {
+        return profile_counters;
     }
 };
 
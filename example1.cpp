@@ -1,4 +1,6 @@
 #include "engine.h"
+#include "terminal_sink.h"
+#include "async_sink.h"
 // axes: X - left, Z - forward, Y - down
 
 int main() {
@@ -9,15 +11,16 @@ int main() {
 
     const float pixel_aspect = font_width / font_height;
     RaytracingEngine engine(width, height, pixel_aspect);
+    engine.set_output_sink(std::make_unique<AsyncSink>(make_terminal_sink()));
     
     engine.camera.set_position({0, -1.2, -1.2});
     engine.light.set_position({0, -10, -10});
 
-    engine.scene.add_object(new ChessPlane({0, 0, 0}, 0.5, 0.1, 0.3));
-    engine.scene.add_object(new Sphere({-1, -0.5, 0}, 0.5, 1));
-    engine.scene.add_object(new Cone({0, -0.75, -1}, {0, 1, 0}, 0.3, 0.75, 1));
-    engine.scene.add_object(new RectPrism({1, 0, 0}, {0, -1, 0}, {0, 0, 1}, 1, 1, 0.5, 1));
-    engine.scene.add_object(new Cylinder({0.1768, -0.5, 0.8232}, {-1, 0, 1}, 0.35, 0.5, 1));
+    engine.scene.add_object(ChessPlane({0, 0, 0}, 0.5, 0.1, 0.3));
+    engine.scene.add_object(Sphere({-1, -0.5, 0}, 0.5, 1));
+    engine.scene.add_object(Cone({0, -0.75, -1}, {0, 1, 0}, 0.3, 0.75, 1));
+    engine.scene.add_object(RectPrism({1, 0, 0}, {0, -1, 0}, {0, 0, 1}, 1, 1, 0.5, 1));
+    engine.scene.add_object(Cylinder({0.1768, -0.5, 0.8232}, {-1, 0, 1}, 0.35, 0.5, 1));
 
     Vec3 angular_velocity = {0.023, 0.025, 0.025};
 
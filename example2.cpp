@@ -1,4 +1,6 @@
 #include "engine.h"
+#include "terminal_sink.h"
+#include "async_sink.h"
 // axes: X - left, Z - forward, Y - down
 
 int main() {
@@ -9,13 +11,14 @@ int main() {
 
     const float pixel_aspect = font_width / font_height;
     RaytracingEngine engine(width, height, pixel_aspect);
+    engine.set_output_sink(std::make_unique<AsyncSink>(make_terminal_sink()));
     
     engine.camera.set_position({0, -0.1, -0.6});
     engine.light.set_position({0, -100, -100});
 
-    engine.scene.add_object(new ChessPlane({0, 0, 0}, 0.5, 0.1, 0.3));
-    engine.scene.add_object(new Sphere({-0.5, -0.5, 0}, 0.5, 1));
-    engine.scene.add_object(new Sphere({0.5, -0.5, 0}, 0.5, 1));
+    engine.scene.add_object(ChessPlane({0, 0, 0}, 0.5, 0.1, 0.3));
+    engine.scene.add_object(Sphere({-0.5, -0.5, 0}, 0.5, 1));
+    engine.scene.add_object(Sphere({0.5, -0.5, 0}, 0.5, 1));
 
     Vec3 angular_velocity = {0, 0.025, 0};
     Vec3 camera_focus = {0, -0.5, 0};
@@ -0,0 +1,155 @@
+#ifndef FRAME_STREAM_H_INCLUDED
+#define FRAME_STREAM_H_INCLUDED
+#include "output_sink.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+
+// Frame stream file: an 8-byte magic, the width and the height as 32-bit integers, then every frame as its
+// size in bytes followed by its characters run-length encoded as (count 1..255, character) pairs.
+// Integers are little-endian.
+struct FrameStreamFormat {
+    static constexpr char magic[8] = {'R', 'T', 'F', 'R', 'A', 'M', 'E', '1'};
+
+    static void put_u32(std::vector<unsigned char>& out, uint32_t value) {
+        for (int k = 0; k < 4; ++k) {
+            out.push_back(static_cast<unsigned char>(value >> (8 * k)));
+        }
+    }
+
+    static uint32_t get_u32(const unsigned char* in) {
+        return in[0] | (in[1] << 8) | (in[2] << 16) | (static_cast<uint32_t>(in[3]) << 24);
+    }
+};
+
+
+// writes presented frames to a frame stream file as they come
+class FrameStreamWriter : public OutputSink {
+private:
+    FILE* file;
+    int width = 0;
+    int height = 0;
+    long long frame_count = 0;
+    std::vector<unsigned char> record;
+
+public:
+    explicit FrameStreamWriter(const std::string& path) {
+        file = std::fopen(path.c_str(), "wb");
+        if (!file) {
+            throw std::runtime_error("Cannot open " + path);
+        }
+    }
+
+    FrameStreamWriter(const FrameStreamWriter&) = delete;
+    FrameStreamWriter& operator=(const FrameStreamWriter&) = delete;
+
+    void present(const char* screen, int width, int height) override {
+        record.clear();
+        if (frame_count == 0) {
+            record.insert(record.end(), FrameStreamFormat::magic, FrameStreamFormat::magic + sizeof(FrameStreamFormat::magic));
+            FrameStreamFormat::put_u32(record, static_cast<uint32_t>(width));
+            FrameStreamFormat::put_u32(record, static_cast<uint32_t>(height));
+            this->width = width;
+            this->height = height;
+        } else if (width != this->width || height != this->height) {
+            throw std::invalid_argument("All frames of a stream must have the same size");
+        }
+
+        const size_t size_at = record.size();
+        FrameStreamFormat::put_u32(record, 0);
+        const int size = width * height;
+        for (int k = 0; k < size;) {
+            int run = 1;
+            while (k + run < size && run < 255 && screen[k + run] == screen[k]) ++run;
+            record.push_back(static_cast<unsigned char>(run));
+            record.push_back(static_cast<unsigned char>(screen[k]));
+            k += run;
+        }
+        const uint32_t encoded_size = static_cast<uint32_t>(record.size() - size_at - 4);
+        for (int k = 0; k < 4; ++k) {
+            record[size_at + k] = static_cast<unsigned char>(encoded_size >> (8 * k));
+        }
+
+        if (std::fwrite(record.data(), 1, record.size(), file) != record.size()) {
+            throw std::runtime_error("Cannot write frame stream");
+        }
+        ++frame_count;
+    }
+
+    long long get_frame_count() const {
+        return frame_count;
+    }
+
+    ~FrameStreamWriter() {
+        std::fclose(file);
+    }
+};
+
+
+// reads the frames of a frame stream file one after another
+class FrameStreamReader {
+private:
+    FILE* file;
+    int width = 0;
+    int height = 0;
+    std::vector<unsigned char> record;
+
+public:
+    explicit FrameStreamReader(const std::string& path) {
+        file = std::fopen(path.c_str(), "rb");
+        if (!file) {
+            throw std::runtime_error("Cannot open " + path);
+        }
+        unsigned char header[sizeof(FrameStreamFormat::magic) + 8];
+        if (std::fread(header, 1, sizeof(header), file) != sizeof(header) ||
+            std::memcmp(header, FrameStreamFormat::magic, sizeof(FrameStreamFormat::magic)) != 0) {
+            std::fclose(file);
+            throw std::runtime_error(path + " is not a frame stream");
+        }
+        width = static_cast<int>(FrameStreamFormat::get_u32(header + 8));
+        height = static_cast<int>(FrameStreamFormat::get_u32(header + 12));
+    }
+
+    FrameStreamReader(const FrameStreamReader&) = delete;
+    FrameStreamReader& operator=(const FrameStreamReader&) = delete;
+
+    // reads the next frame into screen, false at the end of the stream
+    bool next(std::vector<char>& screen) {
+        unsigned char size_bytes[4];
+        if (std::fread(size_bytes, 1, 4, file) != 4) {
+            return false;
+        }
+        record.resize(FrameStreamFormat::get_u32(size_bytes));
+        if (std::fread(record.data(), 1, record.size(), file) != record.size() || record.size() % 2 != 0) {
+            throw std::runtime_error("Truncated frame stream");
+        }
+
+        const size_t size = static_cast<size_t>(width) * height;
+        screen.clear();
+        for (size_t k = 0; k < record.size(); k += 2) {
+            screen.insert(screen.end(), record[k], static_cast<char>(record[k + 1]));
+        }
+        if (screen.size() != size) {
+            throw std::runtime_error("Corrupt frame in frame stream");
+        }
+        return true;
+    }
+
+    int get_width() const {
+        return width;
+    }
+
+    int get_height() const {
+        return height;
+    }
+
+    ~FrameStreamReader() {
+        std::fclose(file);
+    }
+};
+
+#endif //FRAME_STREAM_H_INCLUDED
@@ -0,0 +1,89 @@
+#ifndef INSTANCE_H_INCLUDED
+#define INSTANCE_H_INCLUDED
+#include "tools.h"
+#include "objects.h"
+#include <memory>
+#include <stdexcept>
+
+
+class Instance : public HitObject {
+// A copy of shared geometry placed with a rotation, a uniform scale and a translation. Rays are moved into
+// the space of the geometry, so copies of a mesh share its triangles and BVH and the scene BVH over the
+// instances acts as the top level. The geometry itself is not added to the scene.
+private:
+    std::shared_ptr<const Object> geometry;
+    RotationMat rotation;
+    RotationMat inverse_rotation;
+    Vec3 translation;
+    float scale;
+
+    Vec3 to_local(const Vec3& point) const {
+        return inverse_rotation * (point - translation) * (1 / scale);
+    }
+
+public:
+    Instance(std::shared_ptr<const Object> geometry, const RotationMat& rotation, const Vec3& translation, float scale = 1)
+        : geometry(std::move(geometry)) {
+        if (!this->geometry) {
+            throw std::invalid_argument("Instance geometry cannot be null");
+        }
+        set_transform(rotation, translation, scale);
+    }
+
+    Instance(std::shared_ptr<const Object> geometry, const Vec3& rotation_angles, const Vec3& translation, float scale = 1)
+        : Instance(std::move(geometry), RotationMat(rotation_angles), translation, scale) {}
+
+    // the scene has to be told with Scene::update_object, its BVH keeps the old bounds until then
+    void set_transform(const RotationMat& new_rotation, const Vec3& new_translation, float new_scale = 1) {
+        if (new_scale <= 0) {
+            throw std::invalid_argument("Instance scale must be positive");
+        }
+        rotation = new_rotation;
+        inverse_rotation = new_rotation.transposed();
+        translation = new_translation;
+        scale = new_scale;
+    }
+
+    std::optional<float> hit(const Vec3& line_point, const Vec3& line_dir, float t_max = INFINITY) const override {
+        // the transform is affine, so t is the same in both spaces
+        return geometry->hit(to_local(line_point), inverse_rotation * line_dir * (1 / scale), t_max);
+    }
+
+    Vec3 norm_dir(const Vec3& point) const override {
+        return rotation * geometry->norm_dir(to_local(point));
+    }
+
+    float get_reflection_coeff(const Vec3& point) const override {
+        return geometry->get_reflection_coeff(to_local(point));
+    }
+
+    float max_reflection_coeff() const override {
+        return geometry->max_reflection_coeff();
+    }
+
+    std::optional<AABB> bounding_box() const override {
+        auto local_box = geometry->bounding_box();
+        if (!local_box) {
+            return std::nullopt;
+        }
+
+        AABB box;
+        for (int corner = 0; corner < 8; ++corner) {
+            Vec3 local_corner(corner & 1 ? local_box->max.x : local_box->min.x,
+                              corner & 2 ? local_box->max.y : local_box->min.y,
+                              corner & 4 ? local_box->max.z : local_box->min.z);
+            box.expand(rotation * (local_corner * scale) + translation);
+        }
+        return box;
+    }
+
+    void translate(const Vec3& offset) override {
+        translation += offset;
+    }
+
+    const std::shared_ptr<const Object>& get_geometry() const {
+        return geometry;
+    }
+};
+
+#endif //INSTANCE_H_INCLUDED
@@ -0,0 +1,304 @@
+#ifndef MESH_H_INCLUDED
+#define MESH_H_INCLUDED
+#include "tools.h"
+#include "objects.h"
+#include "bvh.h"
+#include "packet.h"
+#include "profile.h"
+#include "mapped_file.h"
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <stdexcept>
+
+
+class TriangleMesh : public HitObject {
+// Triangles over a shared vertex array with a BVH of their own, so a ray costs about log(n) triangle tests.
+// The normal of a triangle follows its winding: counterclockwise seen from the front.
+private:
+    std::vector<Vec3> vertices;
+    std::vector<int> indices; // three per triangle
+    float reflection_coeff;
+
+    BVH bvh;
+    AABB bounds;
+
+    // triangles tested at once, as many as a BVH leaf holds
+    static constexpr int batch = BVH::max_leaf_size;
+#if RT_VECTOR_PACKETS
+    typedef Lanes<batch> Batch;
+#endif
+
+    // Moller-Trumbore data in BVH leaf order: first vertex, the two edges from it and the unit normal;
+    // the vertex and edge arrays are padded with batch - 1 zeros so any leaf can be loaded in whole batches
+    struct Triangles {
+        std::vector<float> v0_x, v0_y, v0_z;
+        std::vector<float> e1_x, e1_y, e1_z;
+        std::vector<float> e2_x, e2_y, e2_z;
+        std::vector<Vec3> norm;
+    } triangles;
+
+    void build() {
+        const int num_triangles = static_cast<int>(indices.size() / 3);
+        for (int index : indices) {
+            if (index < 0 || index >= static_cast<int>(vertices.size())) {
+                throw std::invalid_argument("Triangle index out of range");
+            }
+        }
+
+        std::vector<AABB> boxes(num_triangles);
+        bounds = AABB();
+        for (int k = 0; k < num_triangles; ++k) {
+            for (int c = 0; c < 3; ++c) {
+                boxes[k].expand(vertices[indices[3*k + c]]);
+            }
+            bounds.expand(boxes[k]);
+        }
+        bvh.build(boxes);
+
+        triangles = Triangles();
+        for (int i = 0; i < num_triangles; ++i) {
+            int k = bvh.get_primitive(i);
+            const Vec3& v0 = vertices[indices[3*k]];
+            Vec3 e1 = vertices[indices[3*k + 1]] - v0;
+            Vec3 e2 = vertices[indices[3*k + 2]] - v0;
+            Vec3 n = e1.cross(e2);
+            float area = n.norm();
+            triangles.v0_x.push_back(v0.x);
+            triangles.v0_y.push_back(v0.y);
+            triangles.v0_z.push_back(v0.z);
+            triangles.e1_x.push_back(e1.x);
+            triangles.e1_y.push_back(e1.y);
+            triangles.e1_z.push_back(e1.z);
+            triangles.e2_x.push_back(e2.x);
+            triangles.e2_y.push_back(e2.y);
+            triangles.e2_z.push_back(e2.z);
+            triangles.norm.push_back(area > 0 ? n * (1 / area) : Vec3(0, -1, 0));
+        }
+        for (std::vector<float>* values : {&triangles.v0_x, &triangles.v0_y, &triangles.v0_z, &triangles.e1_x, &triangles.e1_y,
+                                           &triangles.e1_z, &triangles.e2_x, &triangles.e2_y, &triangles.e2_z}) {
+            values->resize(num_triangles + batch - 1, 0.0f);
+        }
+    }
+
+    // nearest triangle of the leaf range [begin, end) hit before t_max; the triangles are tested a batch at a time
+    // in vector lanes and the nearest hit of a batch is picked afterwards, the first one among equal distances
+    // (one at a time without vector types)
+    int hit_range(int begin, int end, const Vec3& o, const Vec3& d, float& t_max) const {
+#if RT_VECTOR_PACKETS
+        static_assert(batch == 4, "lane offsets below are written for 4 lanes");
+        const Batch::Int offsets = {0, 1, 2, 3};
+        int best = -1;
+        for (int k0 = begin; k0 < end; k0 += batch) {
+            Batch::Float e1_x, e1_y, e1_z, e2_x, e2_y, e2_z, v0_x, v0_y, v0_z;
+            Batch::load(e1_x, &triangles.e1_x[k0]);
+            Batch::load(e1_y, &triangles.e1_y[k0]);
+            Batch::load(e1_z, &triangles.e1_z[k0]);
+            Batch::load(e2_x, &triangles.e2_x[k0]);
+            Batch::load(e2_y, &triangles.e2_y[k0]);
+            Batch::load(e2_z, &triangles.e2_z[k0]);
+            Batch::load(v0_x, &triangles.v0_x[k0]);
+            Batch::load(v0_y, &triangles.v0_y[k0]);
+            Batch::load(v0_z, &triangles.v0_z[k0]);
+
+            const Batch::Float p_x = d.y * e2_z - d.z * e2_y;
+            const Batch::Float p_y = d.z * e2_x - d.x * e2_z;
+            const Batch::Float p_z = d.x * e2_y - d.y * e2_x;
+            const Batch::Float det = e1_x * p_x + e1_y * p_y + e1_z * p_z;
+            const Batch::Float inv_det = 1 / det;
+
+            const Batch::Float s_x = o.x - v0_x, s_y = o.y - v0_y, s_z = o.z - v0_z;
+            const Batch::Float u = (s_x * p_x + s_y * p_y + s_z * p_z) * inv_det;
+            const Batch::Float q_x = s_y * e1_z - s_z * e1_y;
+            const Batch::Float q_y = s_z * e1_x - s_x * e1_z;
+            const Batch::Float q_z = s_x * e1_y - s_y * e1_x;
+            const Batch::Float v = (d.x * q_x + d.y * q_y + d.z * q_z) * inv_det;
+            const Batch::Float t = (e2_x * q_x + e2_y * q_y + e2_z * q_z) * inv_det;
+
+            const Batch::Int hit = (det > 1e-12f || det < -1e-12f) && u >= 0 && v >= 0 && u + v <= 1 &&
+                                   t > 1e-4f && t < t_max && offsets + k0 < end;
+            float lane_t[batch];
+            int lane_hit[batch];
+            Batch::store(lane_t, t);
+            Batch::store(lane_hit, hit);
+            for (int k = 0; k < batch; ++k) {
+                if (lane_hit[k] && lane_t[k] < t_max) {
+                    t_max = lane_t[k];
+                    best = k0 + k;
+                }
+            }
+        }
+        return best;
+#else
+        int best = -1;
+        for (int k = begin; k < end; ++k) {
+            const float e1_x = triangles.e1_x[k], e1_y = triangles.e1_y[k], e1_z = triangles.e1_z[k];
+            const float e2_x = triangles.e2_x[k], e2_y = triangles.e2_y[k], e2_z = triangles.e2_z[k];
+            const float p_x = d.y * e2_z - d.z * e2_y;
+            const float p_y = d.z * e2_x - d.x * e2_z;
+            const float p_z = d.x * e2_y - d.y * e2_x;
+            const float det = e1_x * p_x + e1_y * p_y + e1_z * p_z;
+            const float inv_det = 1 / det;
+
+            const float s_x = o.x - triangles.v0_x[k], s_y = o.y - triangles.v0_y[k], s_z = o.z - triangles.v0_z[k];
+            const float u = (s_x * p_x + s_y * p_y + s_z * p_z) * inv_det;
+            const float q_x = s_y * e1_z - s_z * e1_y;
+            const float q_y = s_z * e1_x - s_x * e1_z;
+            const float q_z = s_x * e1_y - s_y * e1_x;
+            const float v = (d.x * q_x + d.y * q_y + d.z * q_z) * inv_det;
+            const float t = (e2_x * q_x + e2_y * q_y + e2_z * q_z) * inv_det;
+
+            if (std::fabs(det) > 1e-12f && u >= 0 && v >= 0 && u + v <= 1 && t > 1e-4f && t < t_max) {
+                t_max = t;
+                best = k;
+            }
+        }
+        return best;
+#endif
+    }
+
+    static const char* skip_spaces(const char* p, const char* end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) ++p;
+        return p;
+    }
+
+public:
+    TriangleMesh(std::vector<Vec3> vertices, std::vector<int> indices, float reflection_coeff)
+        : vertices(std::move(vertices)), indices(std::move(indices)), reflection_coeff(reflection_coeff) {
+        if (this->indices.size() % 3 != 0) {
+            throw std::invalid_argument("Number of indices must be a multiple of 3");
+        }
+        build();
+    }
+
+    // Reads the vertices and faces of a Wavefront OBJ file; polygons are split into triangle fans and
+    // everything else (normals, texture coordinates, materials, groups) is ignored.
+    static TriangleMesh load_obj(const std::string& path, float reflection_coeff) {
+        // the file is mapped, not read, and only the line being parsed is copied, so that strtof and strtol
+        // stop at its terminating zero rather than run past the end of the mapping
+        const MappedFile file(path);
+        const char* data = file.get_data();
+        const char* const data_end = data + file.get_size();
+
+        std::vector<Vec3> vertices;
+        std::vector<int> indices;
+        std::vector<int> face;
+        std::string line;
+        int line_number = 0;
+
+        while (data < data_end) {
+            const char* next_line = data;
+            while (next_line < data_end && *next_line != '\n') ++next_line;
+            line.assign(data, next_line);
+            data = next_line + 1;
+            ++line_number;
+            const char* line_end = line.c_str() + line.size();
+            const char* p = skip_spaces(line.c_str(), line_end);
+
+            if (line_end - p > 1 && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')) {
+                float xyz[3];
+                p += 2;
+                for (float& c : xyz) {
+                    char* next;
+                    c = std::strtof(p, &next);
+                    if (next == p) {
+                        throw std::runtime_error(path + ":" + std::to_string(line_number) + ": bad vertex");
+                    }
+                    p = next;
+                }
+                vertices.push_back(Vec3(xyz[0], xyz[1], xyz[2]));
+            } else if (line_end - p > 1 && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) {
+                face.clear();
+                p = skip_spaces(p + 2, line_end);
+                while (p < line_end) {
+                    char* next;
+                    long index = std::strtol(p, &next, 10);
+                    if (next == p || index == 0) {
+                        throw std::runtime_error(path + ":" + std::to_string(line_number) + ": bad face");
+                    }
+                    // 1-based, negative values count back from the last vertex read
+                    face.push_back(index > 0 ? static_cast<int>(index - 1) : static_cast<int>(vertices.size() + index));
+                    p = next;
+                    while (p < line_end && *p != ' ' && *p != '\t' && *p != '\r') ++p; // skip /texture/normal
+                    p = skip_spaces(p, line_end);
+                }
+                for (size_t k = 2; k < face.size(); ++k) {
+                    indices.push_back(face[0]);
+                    indices.push_back(face[k - 1]);
+                    indices.push_back(face[k]);
+                }
+            }
+        }
+
+        return TriangleMesh(std::move(vertices), std::move(indices), reflection_coeff);
+    }
+
+    std::optional<float> hit(const Vec3& line_point, const Vec3& line_dir, float t_max = INFINITY) const override {
+        bool found = false;
+        bvh.traverse_leaves(line_point, line_dir, t_max, [&](int begin, int end) {
+            RT_PROFILE_ADD(triangle_tests, end - begin);
+            found |= hit_range(begin, end, line_point, line_dir, t_max) >= 0;
+            return false;
+        });
+        if (found) {
+            return t_max;
+        }
+        return std::nullopt;
+    }
+
+    // normal of the triangle whose plane passes closest to the point among those containing it
+    Vec3 norm_dir(const Vec3& point) const override {
+        const float pad = 1e-3;
+        Vec3 best_norm(0, -1, 0);
+        float best_dist = INFINITY;
+        bvh.query_point(point, pad, [&](int begin, int end) {
+            for (int k = begin; k < end; ++k) {
+                const Vec3& n = triangles.norm[k];
+                Vec3 v0(triangles.v0_x[k], triangles.v0_y[k], triangles.v0_z[k]);
+                Vec3 e1(triangles.e1_x[k], triangles.e1_y[k], triangles.e1_z[k]);
+                Vec3 e2(triangles.e2_x[k], triangles.e2_y[k], triangles.e2_z[k]);
+                Vec3 r = point - v0;
+                float dist = std::fabs(n.dot(r));
+                // outside one of the edges by more than pad ranks the triangle behind every containing one
+                if (e1.cross(r).dot(n) < -pad * e1.norm() || r.cross(e2).dot(n) < -pad * e2.norm() ||
+                    (e2 - e1).cross(r - e1).dot(n) < -pad * (e2 - e1).norm()) {
+                    dist += 1;
+                }
+                if (dist < best_dist) {
+                    best_dist = dist;
+                    best_norm = n;
+                }
+            }
+        });
+        return best_norm;
+    }
+
+    float get_reflection_coeff(const Vec3&) const override {
+        return reflection_coeff;
+    }
+
+    float max_reflection_coeff() const override {
+        return reflection_coeff;
+    }
+
+    std::optional<AABB> bounding_box() const override {
+        if (indices.empty()) {
+            return std::nullopt;
+        }
+        return bounds;
+    }
+
+    const std::vector<Vec3>& get_vertices() const {
+        return vertices;
+    }
+
+    const std::vector<int>& get_indices() const {
+        return indices;
+    }
+
+    int get_num_triangles() const {
+        return static_cast<int>(indices.size() / 3);
+    }
+};
+
+#endif //MESH_H_INCLUDED
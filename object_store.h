@@ -0,0 +1,125 @@
+#ifndef OBJECT_STORE_H_INCLUDED
+#define OBJECT_STORE_H_INCLUDED
+#include "tools.h"
+#include "objects.h"
+#include <deque>
+#include <memory>
+#include <tuple>
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
+#include <vector>
+
+
+// object tagged with its exact type, so the hot queries can call the built-in types without a virtual call
+struct ObjectRef {
+    enum Kind { PLANE, CHESS_PLANE, SPHERE, RECT, RECT_PRISM, CUBE, CYLINDER, CONE, CUSTOM };
+
+    Object* object;
+    Kind kind;
+};
+
+
+class ObjectStore {
+// Owns the objects of a scene. Built-in types created with emplace live by value in one deque per type,
+// which keeps them together in memory and their addresses stable; other objects are owned through pointers.
+private:
+    std::tuple<std::deque<Plane>, std::deque<ChessPlane>, std::deque<Sphere>, std::deque<Rect>,
+               std::deque<RectPrism>, std::deque<Cube>, std::deque<Cylinder>, std::deque<Cone>> built_in;
+    std::vector<std::unique_ptr<Object>> custom;
+
+    template <class T, int I = 0>
+    static constexpr int type_index() {
+        if constexpr (I == std::tuple_size<decltype(built_in)>::value) {
+            return -1;
+        } else if constexpr (std::is_same<T, typename std::tuple_element<I, decltype(built_in)>::type::value_type>::value) {
+            return I;
+        } else {
+            return type_index<T, I + 1>();
+        }
+    }
+
+    template <int I = 0>
+    static ObjectRef::Kind kind_by_type(const std::type_info& type) {
+        if constexpr (I == std::tuple_size<decltype(built_in)>::value) {
+            return ObjectRef::CUSTOM;
+        } else {
+            using T = typename std::tuple_element<I, decltype(built_in)>::type::value_type;
+            return type == typeid(T) ? static_cast<ObjectRef::Kind>(I) : kind_by_type<I + 1>(type);
+        }
+    }
+
+    // calls f with the object cast to its exact type, or with the Object itself for CUSTOM
+    template <class F>
+    static auto visit(const ObjectRef& ref, F&& f) {
+        switch (ref.kind) {
+            case ObjectRef::PLANE: return f(static_cast<const Plane&>(*ref.object));
+            case ObjectRef::CHESS_PLANE: return f(static_cast<const ChessPlane&>(*ref.object));
+            case ObjectRef::SPHERE: return f(static_cast<const Sphere&>(*ref.object));
+            case ObjectRef::RECT: return f(static_cast<const Rect&>(*ref.object));
+            case ObjectRef::RECT_PRISM: return f(static_cast<const RectPrism&>(*ref.object));
+            case ObjectRef::CUBE: return f(static_cast<const Cube&>(*ref.object));
+            case ObjectRef::CYLINDER: return f(static_cast<const Cylinder&>(*ref.object));
+            case ObjectRef::CONE: return f(static_cast<const Cone&>(*ref.object));
+            default: return f(static_cast<const Object&>(*ref.object));
+        }
+    }
+
+public:
+    ObjectStore() {}
+    ObjectStore(const ObjectStore&) = delete;
+    ObjectStore& operator=(const ObjectStore&) = delete;
+
+    template <class T, class... Args>
+    ObjectRef emplace(Args&&... args) {
+        if constexpr (type_index<T>() < 0) {
+            return add(new T(std::forward<Args>(args)...));
+        } else {
+            T& obj = std::get<type_index<T>()>(built_in).emplace_back(std::forward<Args>(args)...);
+            return {&obj, static_cast<ObjectRef::Kind>(type_index<T>())};
+        }
+    }
+
+    // takes ownership of an object allocated with new
+    ObjectRef add(Object* obj) {
+        custom.emplace_back(obj);
+        return {obj, kind_by_type(typeid(*obj))};
+    }
+
+    // the calls below are qualified with the exact type, so the compiler can inline them
+
+    static std::optional<float> hit(const ObjectRef& ref, const Vec3& line_point, const Vec3& line_dir, float t_max = INFINITY) {
+        return visit(ref, [&](const auto& obj) {
+            using T = typename std::decay<decltype(obj)>::type;
+            if constexpr (std::is_same<T, Object>::value) {
+                return obj.hit(line_point, line_dir, t_max);
+            } else {
+                return obj.T::hit(line_point, line_dir, t_max);
+            }
+        });
+    }
+
+    static Vec3 norm_dir(const ObjectRef& ref, const Vec3& point) {
+        return visit(ref, [&](const auto& obj) {
+            using T = typename std::decay<decltype(obj)>::type;
+            if constexpr (std::is_same<T, Object>::value) {
+                return obj.norm_dir(point);
+            } else {
+                return obj.T::norm_dir(point);
+            }
+        });
+    }
+
+    static float get_reflection_coeff(const ObjectRef& ref, const Vec3& point) {
+        return visit(ref, [&](const auto& obj) {
+            using T = typename std::decay<decltype(obj)>::type;
+            if constexpr (std::is_same<T, Object>::value) {
+                return obj.get_reflection_coeff(point);
+            } else {
+                return obj.T::get_reflection_coeff(point);
+            }
+        });
+    }
+};
+
+#endif //OBJECT_STORE_H_INCLUDED
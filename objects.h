@@ -4,43 +4,131 @@
 #include <optional>
 
 
+inline Vec3 abs_vec(const Vec3& v) {
+    return Vec3(std::abs(v.x), std::abs(v.y), std::abs(v.z));
+}
+
+// half extents of the bounding box of a disc with unit normal n
+inline Vec3 disc_extent(const Vec3& n, float radius) {
+    return Vec3(radius * std::sqrt(std::fmax(0.0f, 1 - n.x * n.x)),
+                radius * std::sqrt(std::fmax(0.0f, 1 - n.y * n.y)),
+                radius * std::sqrt(std::fmax(0.0f, 1 - n.z * n.z)));
+}
+
+// Sphere around an object, tested before its exact intersection to reject rays that pass far from it.
+// The radius is padded so that rounding never rejects a ray the exact test would hit.
+class BoundingSphere {
+private:
+    Vec3 center;
+    float radius2 = 0;
+
+public:
+    BoundingSphere() {}
+    BoundingSphere(const Vec3& center, float radius): center(center) {
+        radius *= 1 + 1e-4f;
+        radius2 = radius * radius + 1e-8f;
+    }
+
+    // false if the ray cannot reach the sphere at 0 < t < t_max
+    bool may_hit(const Vec3& line_point, const Vec3& line_dir, float t_max) const {
+        Vec3 oc = center - line_point;
+        float c = oc.dot(oc) - radius2;
+        if (c <= 0) {
+            return true;
+        }
+        float a = line_dir.dot(line_dir);
+        float b = oc.dot(line_dir);
+        if (b <= 0) {
+            return false;
+        }
+        float discriminant = b * b - a * c;
+        return discriminant >= 0 && b - std::sqrt(discriminant) < t_max * a;
+    }
+
+    void translate(const Vec3& offset) {
+        center += offset;
+    }
+};
+
+
 class Object {
 public:
-    virtual std::optional<Vec3> intersection(const Vec3&, const Vec3&) const = 0;
+    // Parameter t > 0 of the nearest intersection point line_point + line_dir*t with t < t_max,
+    // by default found from intersection; faster objects derive from HitObject instead.
+    virtual std::optional<float> hit(const Vec3& line_point, const Vec3& line_dir, float t_max = INFINITY) const {
+        auto point = intersection(line_point, line_dir);
+        if (!point) {
+            return std::nullopt;
+        }
+        float t = (point.value() - line_point).norm() / line_dir.norm();
+        if (t < t_max) {
+            return t;
+        }
+        return std::nullopt;
+    }
+
+    virtual std::optional<Vec3> intersection(const Vec3& line_point, const Vec3& line_dir) const = 0;
+
     virtual Vec3 norm_dir(const Vec3&) const = 0;
     virtual float get_reflection_coeff(const Vec3&) const = 0;
+    // upper bound of get_reflection_coeff over the whole surface, infinite when unknown
+    virtual float max_reflection_coeff() const { return INFINITY; }
+    // objects without a bounding box (infinite planes) are tested against every ray
+    virtual std::optional<AABB> bounding_box() const { return std::nullopt; }
+    // moves the object by offset; a scene must be told with Scene::update_object afterwards
+    virtual void translate(const Vec3&) {
+        throw std::runtime_error("This object cannot be moved");
+    }
     virtual ~Object() {}
 };
 
 
-class Plane : public Object {
+// Base of objects that find the ray parameter directly: they override hit and get intersection from it.
+class HitObject : public Object {
+public:
+    std::optional<float> hit(const Vec3& line_point, const Vec3& line_dir, float t_max = INFINITY) const override = 0;
+
+    std::optional<Vec3> intersection(const Vec3& line_point, const Vec3& line_dir) const override {
+        auto t = hit(line_point, line_dir);
+        if (t) {
+            return line_point + line_dir * t.value();
+        }
+        return std::nullopt;
+    }
+};
+
+
+class Plane : public HitObject {
 private:
     Vec3 point;
     Vec3 norm;
     float reflection_coeff;
 
+    friend class PacketScene;
+    friend class ReferenceTracer;
+
 public:
     Plane(const Vec3& point, float refl_coeff=0.5)
         : point(point), norm({0, -1, 0}), reflection_coeff(refl_coeff) {}
 
     Plane(const Vec3& point, const Vec3& norm, float refl_coeff=0.5)
-        : point(point), norm(norm.normalized()), reflection_coeff(refl_coeff) {
+        : point(point), norm(norm.normalized_checked()), reflection_coeff(refl_coeff) {
 
         if (norm.norm() < 1e-6) {
             throw std::runtime_error("Norm cannot be a zero vector");
         }
     }
 
-    std::optional<Vec3> intersection(const Vec3& line_point, const Vec3& line_dir) const override {
+    std::optional<float> hit(const Vec3& line_point, const Vec3& line_dir, float t_max = INFINITY) const override {
         if (fabs(norm.dot(line_dir)) < 1e-6) {
             return std::nullopt;
         }
 
         float t = norm.dot(point - line_point) / norm.dot(line_dir);
 
-        if (t > 0) {
-            return line_point + line_dir * t;
-        } 
+        if (t > 0 && t < t_max) {
+            return t;
+        }
 
         return std::nullopt;
     }
@@ -52,10 +140,18 @@ public:
     float get_reflection_coeff(const Vec3&) const override {
         return reflection_coeff;
     }
+
+    float max_reflection_coeff() const override {
+        return reflection_coeff;
+    }
+
+    void translate(const Vec3& offset) override {
+        point += offset;
+    }
 };
 
 
-class ChessPlane : public Object {
+class ChessPlane : public HitObject {
 private:
     Vec3 point;       
     Vec3 norm;         
@@ -63,12 +159,15 @@ private:
     float reflection_coeff_black;
     float reflection_coeff_white;
 
+    friend class PacketScene;
+    friend class ReferenceTracer;
+
 public:
     ChessPlane(const Vec3& point, float square_size=0.5, float refl_coeff_black = 0.1, float refl_coeff_white = 0.3)
         : point(point), norm(0, -1, 0), square_size(square_size), reflection_coeff_black(refl_coeff_black), reflection_coeff_white(refl_coeff_white) {}
 
     ChessPlane(const Vec3& point, const Vec3& norm, float square_size=0.5, float refl_coeff_black = 0.1, float refl_coeff_white = 0.3)
-        : point(point), norm(norm.normalized()), square_size(square_size), reflection_coeff_black(refl_coeff_black), reflection_coeff_white(refl_coeff_white) {
+        : point(point), norm(norm.normalized_checked()), square_size(square_size), reflection_coeff_black(refl_coeff_black), reflection_coeff_white(refl_coeff_white) {
 
         if (norm.norm() < 1e-6) {
             throw std::runtime_error("Norm cannot be a zero vector");
@@ -76,15 +175,15 @@ public:
     }
 
 
-    std::optional<Vec3> intersection(const Vec3& line_point, const Vec3& line_dir) const override {
+    std::optional<float> hit(const Vec3& line_point, const Vec3& line_dir, float t_max = INFINITY) const override {
         if (fabs(norm.dot(line_dir)) < 1e-6) {
             return std::nullopt;
         }
 
         float t = norm.dot(point - line_point) / norm.dot(line_dir);
 
-        if (t > 0) {
-            return line_point + line_dir * t;
+        if (t > 0 && t < t_max) {
+            return t;
         }
 
         return std::nullopt;
@@ -107,44 +206,48 @@ public:
             return reflection_coeff_white;
         }
     }
+
+    float max_reflection_coeff() const override {
+        return std::fmax(reflection_coeff_black, reflection_coeff_white);
+    }
+
+    void translate(const Vec3& offset) override {
+        point += offset;
+    }
 };
 
 
-class Sphere : public Object {
+class Sphere : public HitObject {
 private:
     Vec3 center;
     float radius;
     float reflection_coeff;
 
+    friend class PacketScene;
+    friend class ReferenceTracer;
+
 public:
     Sphere(const Vec3& center, float radius, float refl_coeff=0.5) 
         : center(center), radius(radius), reflection_coeff(refl_coeff) {}
 
-    std::optional<Vec3> intersection(const Vec3& line_point, const Vec3& line_dir) const override {
+    std::optional<float> hit(const Vec3& line_point, const Vec3& line_dir, float t_max = INFINITY) const override {
         Vec3 oc = line_point - center;
         float a = line_dir.dot(line_dir);
         float b = 2.0 * oc.dot(line_dir);
         float c = oc.dot(oc) - radius * radius;
 
         float discriminant = b * b - 4 * a * c;
+        if (discriminant < 0) {
+            return std::nullopt;
+        }
 
-        if (discriminant > 0) {
-            float t1 = (-b - sqrt(discriminant)) / (2.0 * a);
-            float t2 = (-b + sqrt(discriminant)) / (2.0 * a);
-            Vec3 intersection1 = line_point + line_dir * t1;
-            Vec3 intersection2 = line_point + line_dir * t2;
-            if (t1 > 0 && t2 > 0) {
-                return t1 < t2 ? intersection1 : intersection2;
-            } else if (t1 > 0) {
-                return intersection1;
-            } else if (t2 > 0) {
-                return intersection2;
-            }
-        } else if (discriminant == 0) {
-            float t = -b / (2.0 * a);
-            if (t > 0) {
-                return line_point + line_dir * t;
-            }
+        float root = sqrt(discriminant);
+        float t1 = (-b - root) / (2.0 * a);
+        float t2 = (-b + root) / (2.0 * a);
+        float t = t1 > 0 ? t1 : t2;
+
+        if (t > 0 && t < t_max) {
+            return t;
         }
 
         return std::nullopt;
@@ -158,10 +261,23 @@ public:
         return reflection_coeff;
     }
 
+    float max_reflection_coeff() const override {
+        return reflection_coeff;
+    }
+
+    std::optional<AABB> bounding_box() const override {
+        Vec3 r(radius, radius, radius);
+        return AABB(center - r, center + r);
+    }
+
+    void translate(const Vec3& offset) override {
+        center += offset;
+    }
+
 };
 
 
-class Rect : public Object {
+class Rect : public HitObject {
 private:
     Vec3 center;
     Vec3 norm;
@@ -171,10 +287,12 @@ private:
     float height;
     float reflection_coeff;
 
+    friend class ReferenceTracer;
+
 public:
     Rect() {}
     Rect(const Vec3& center, const Vec3& norm, const Vec3& width_dir, float width, float height, float reflection_coeff)
-        : center(center), norm(norm.normalized()), width_dir(width_dir.normalized()), height_dir(norm.cross(width_dir).normalized()), width(width), height(height), reflection_coeff(reflection_coeff) {
+        : center(center), norm(norm.normalized_checked()), width_dir(width_dir.normalized_checked()), height_dir(norm.cross(width_dir).normalized_checked()), width(width), height(height), reflection_coeff(reflection_coeff) {
         if (norm.norm() < 1e-6 || width_dir.norm() < 1e-6) {
             throw std::runtime_error("Norm or width_dir vector cannot be a zero vector");
         }
@@ -183,18 +301,17 @@ public:
         }
     }
 
-    std::optional<Vec3> intersection(const Vec3& line_point, const Vec3& line_dir) const override {
-       if (fabs(norm.dot(line_dir)) < 1e-6) {
+    std::optional<float> hit(const Vec3& line_point, const Vec3& line_dir, float t_max = INFINITY) const override {
+        if (fabs(norm.dot(line_dir)) < 1e-6) {
             return std::nullopt;
         }
 
         float t = norm.dot(center - line_point) / norm.dot(line_dir);
 
-        if (t > 0) {
-            Vec3 possible_intersection = line_point + line_dir * t;
-            Vec3 local_point = possible_intersection - center;
+        if (t > 0 && t < t_max) {
+            Vec3 local_point = line_point + line_dir * t - center;
             if (fabs(width_dir.dot(local_point)) < width/2 && fabs(height_dir.dot(local_point)) < height/2) {
-                return possible_intersection;
+                return t;
             }
         }
 
@@ -208,11 +325,23 @@ public:
     float get_reflection_coeff(const Vec3&) const override {
         return reflection_coeff;
     }
+
+    float max_reflection_coeff() const override {
+        return reflection_coeff;
+    }
+
+    std::optional<AABB> bounding_box() const override {
+        Vec3 half = abs_vec(width_dir) * (width/2) + abs_vec(height_dir) * (height/2);
+        return AABB(center - half, center + half);
+    }
+
+    void translate(const Vec3& offset) override {
+        center += offset;
+    }
 };
 
 
-class RectPrism : public Object {
-// this class doesn't work if height_dir or width_dir are not parallel to the axes
+class RectPrism : public HitObject {
 private:
     Vec3 base_center;
     Vec3 height_dir;
@@ -223,11 +352,30 @@ private:
     float length;
     float reflection_coeff;
 
-    Rect faces[6];
+    friend class PacketScene;
+    friend class ReferenceTracer;
+
+    Vec3 center() const {
+        return base_center + height_dir * (height/2);
+    }
+
+    // narrows [t_near, t_far] to the part of the ray between the two faces across one axis of the prism,
+    // o and d being the offset from the center and the direction along the axis
+    static bool clip_slab(float o, float d, float half, float& t_near, float& t_far) {
+        if (std::fabs(d) < 1e-12f) {
+            return std::fabs(o) <= half;
+        }
+        float t0 = (-half - o) / d;
+        float t1 = (half - o) / d;
+        if (t0 > t1) std::swap(t0, t1);
+        t_near = std::fmax(t_near, t0);
+        t_far = std::fmin(t_far, t1);
+        return t_near <= t_far;
+    }
 
 public:
     RectPrism(Vec3 base_center, Vec3 height_dir, Vec3 width_dir, float height, float width, float length, float reflection_coeff)
-        : base_center(base_center), height_dir(height_dir.normalized()), width_dir(width_dir.normalized()), length_dir(height_dir.cross(width_dir).normalized()), height(height), width(width), length(length), reflection_coeff(reflection_coeff) {
+        : base_center(base_center), height_dir(height_dir.normalized_checked()), width_dir(width_dir.normalized_checked()), length_dir(height_dir.cross(width_dir).normalized_checked()), height(height), width(width), length(length), reflection_coeff(reflection_coeff) {
         
         if (height_dir.norm() < 1e-6 || width_dir.norm() < 1e-6) {
             throw std::runtime_error("Height_dir or width_dir vector cannot be a zero vector");
@@ -236,48 +384,57 @@ public:
         if (height_dir.dot(width_dir) > 1e-6) {
             throw std::runtime_error("Height_dir and width_dir must be orthogonal");
         }
-
-        faces[0] = Rect(base_center, -height_dir, width_dir, width, length, reflection_coeff); // bottom
-        faces[1] = Rect(base_center + height_dir*height, height_dir, width_dir, width, length, reflection_coeff); // top
-        faces[2] = Rect(base_center - length_dir*(length/2) + height_dir*(height/2), -length_dir, width_dir, width, height, reflection_coeff); // right
-        faces[3] = Rect(base_center + length_dir*(length/2) + height_dir*(height/2), length_dir, width_dir, width, height, reflection_coeff); // left
-        faces[4] = Rect(base_center - width_dir*(width/2) + height_dir*(height/2), -width_dir, length_dir, length, height, reflection_coeff); // front
-        faces[5] = Rect(base_center + width_dir*(width/2) + height_dir*(height/2), width_dir, length_dir, length, height, reflection_coeff); // back
     }
     
-    std::optional<Vec3> intersection(const Vec3& line_point, const Vec3& line_dir) const override {
-        float closest = std::numeric_limits<float>::max();
-        std::optional<Vec3> closest_intersection = std::nullopt;
-
-        for (const auto& face : faces) {
-            auto face_intersection = face.intersection(line_point, line_dir);
-            if (face_intersection) {
-                float t = (face_intersection.value() - line_point).norm();
-                if (t < closest) {
-                    closest = t;
-                    closest_intersection = face_intersection;
-                }
-            }
+    // slab test in the frame of the prism: the entry distance, or the exit distance from inside
+    std::optional<float> hit(const Vec3& line_point, const Vec3& line_dir, float t_max = INFINITY) const override {
+        Vec3 oc = line_point - center();
+        float t_near = -INFINITY;
+        float t_far = INFINITY;
+        if (!clip_slab(oc.dot(height_dir), line_dir.dot(height_dir), height/2, t_near, t_far) ||
+            !clip_slab(oc.dot(width_dir), line_dir.dot(width_dir), width/2, t_near, t_far) ||
+            !clip_slab(oc.dot(length_dir), line_dir.dot(length_dir), length/2, t_near, t_far)) {
+            return std::nullopt;
         }
 
-        return closest_intersection;
+        float t = t_near > 0 ? t_near : t_far;
+        if (t > 0 && t < t_max) {
+            return t;
+        }
+        return std::nullopt;
     }
 
+    // the face of a point on the surface is across the axis along which the point is farthest from the center
+    // in units of the half extent; points on an edge, equally far along two axes up to rounding, take the face
+    // of the height axis, then of the width axis
     Vec3 norm_dir(const Vec3& point) const override {
-        Vec3 min = base_center - width_dir*(width/2) - length_dir*(length/2);
-        Vec3 max = base_center + width_dir*(width/2) + length_dir*(length/2) + height_dir*height;
-
-        if (std::abs(point.dot(height_dir) - min.dot(height_dir)) < 1e-6) return -height_dir;
-        if (std::abs(point.dot(height_dir)- max.dot(height_dir)) < 1e-6) return height_dir;
-        if (std::abs(point.dot(width_dir) - min.dot(width_dir)) < 1e-6) return -width_dir;
-        if (std::abs(point.dot(width_dir) - max.dot(width_dir)) < 1e-6) return width_dir;
-        if (std::abs(point.dot(length_dir) - min.dot(length_dir)) < 1e-6) return -length_dir;
-        return length_dir;
+        Vec3 local = point - center();
+        float u = local.dot(height_dir) / (height/2);
+        float v = local.dot(width_dir) / (width/2);
+        float w = local.dot(length_dir) / (length/2);
+
+        const float tie = 1 - 1e-5f;
+        if (std::fabs(u) >= std::fmax(std::fabs(v), std::fabs(w)) * tie) return u < 0 ? -height_dir : height_dir;
+        if (std::fabs(v) >= std::fabs(w) * tie) return v < 0 ? -width_dir : width_dir;
+        return w < 0 ? -length_dir : length_dir;
     }
 
     float get_reflection_coeff(const Vec3&) const override {
         return reflection_coeff;
     }
+
+    float max_reflection_coeff() const override {
+        return reflection_coeff;
+    }
+
+    std::optional<AABB> bounding_box() const override {
+        Vec3 half = abs_vec(height_dir) * (height/2) + abs_vec(width_dir) * (width/2) + abs_vec(length_dir) * (length/2);
+        return AABB(center() - half, center() + half);
+    }
+
+    void translate(const Vec3& offset) override {
+        base_center += offset;
+    }
 };
 
 
@@ -288,7 +445,7 @@ public:
 };
 
 
-class Cylinder : public Object {
+class Cylinder : public HitObject {
 private:
     Vec3 base_center;
     Vec3 axis_dir;
@@ -296,11 +453,17 @@ private:
     float height;
     float reflection_coeff;
 
+    BoundingSphere bounds;
+
+    friend class PacketScene;
+    friend class ReferenceTracer;
+
 public:
     Cylinder(const Vec3& base_center, const Vec3& axis_dir, float radius, float height, float reflection_coeff)
-        : base_center(base_center), axis_dir(axis_dir.normalized()), radius(radius), height(height), reflection_coeff(reflection_coeff) {}
+        : base_center(base_center), axis_dir(axis_dir.normalized_checked()), radius(radius), height(height), reflection_coeff(reflection_coeff),
+          bounds(base_center + this->axis_dir * (height/2), std::sqrt(radius * radius + height * height / 4)) {}
 
-    std::optional<Vec3> intersection_side(const Vec3& line_point, const Vec3& line_dir) const {
+    std::optional<float> hit_side(const Vec3& line_point, const Vec3& line_dir, float t_max = INFINITY) const {
         Vec3 oc = line_point - base_center;
         Vec3 d = line_dir - axis_dir * line_dir.dot(axis_dir);
         Vec3 o = oc - axis_dir * oc.dot(axis_dir);
@@ -318,70 +481,57 @@ public:
         float t1 = (-b + sqrt(discriminant)) / (2 * a);
 
         float t = (t0 > 0) ? t0 : t1;
-        if (t < 0) {
+        if (t < 0 || t >= t_max) {
             return std::nullopt;
         }
 
-        Vec3 intersection = line_point + line_dir * t;
-        float projection_length = (intersection - base_center).dot(axis_dir);
+        float projection_length = (line_point + line_dir * t - base_center).dot(axis_dir);
 
         if (projection_length < 0 || projection_length > height) {
             return std::nullopt;
         }
 
-        return intersection;
+        return t;
     }
 
-    std::optional<Vec3> base_intersection(const Vec3& line_point, const Vec3& line_dir, const Vec3& base_center) const {
+    std::optional<float> hit_base(const Vec3& line_point, const Vec3& line_dir, const Vec3& base_center, float t_max = INFINITY) const {
         Vec3 base_norm = axis_dir;
         if (fabs(base_norm.dot(line_dir)) < 1e-6) {
             return std::nullopt;
         }
 
         float t = base_norm.dot(base_center - line_point) / base_norm.dot(line_dir);
-        if (t < 0) {
+        if (t < 0 || t >= t_max) {
             return std::nullopt;
         }
 
-        Vec3 intersection = line_point + line_dir * t;
-        if ((intersection - base_center).norm() <= radius) {
-            return intersection;
+        if ((line_point + line_dir * t - base_center).norm() <= radius) {
+            return t;
         }
 
         return std::nullopt;
     }
 
-    std::optional<Vec3> intersection(const Vec3& line_point, const Vec3& line_dir) const override {
-        auto side_intersection = intersection_side(line_point, line_dir);
-
-        auto bottom_intersection = base_intersection(line_point, line_dir, base_center);
-
-        Vec3 top_center = base_center + axis_dir * height;
-        auto top_intersection = base_intersection(line_point, line_dir, top_center);
-
-        std::optional<Vec3> result = std::nullopt;
-        float min_t = std::numeric_limits<float>::max();
+    std::optional<float> hit(const Vec3& line_point, const Vec3& line_dir, float t_max = INFINITY) const override {
+        if (!bounds.may_hit(line_point, line_dir, t_max)) {
+            return std::nullopt;
+        }
 
-        if (side_intersection) {
-            float t = (side_intersection.value() - line_point).norm();
-            if (t < min_t) {
-                min_t = t;
-                result = side_intersection;
-            }
+        std::optional<float> result = hit_side(line_point, line_dir, t_max);
+        if (result) {
+            t_max = result.value();
         }
-        if (bottom_intersection) {
-            float t = (bottom_intersection.value() - line_point).norm();
-            if (t < min_t) {
-                min_t = t;
-                result = bottom_intersection;
-            }
+
+        auto bottom_t = hit_base(line_point, line_dir, base_center, t_max);
+        if (bottom_t) {
+            t_max = bottom_t.value();
+            result = bottom_t;
         }
-        if (top_intersection) {
-            float t = (top_intersection.value() - line_point).norm();
-            if (t < min_t) {
-                min_t = t;
-                result = top_intersection;
-            }
+
+        Vec3 top_center = base_center + axis_dir * height;
+        auto top_t = hit_base(line_point, line_dir, top_center, t_max);
+        if (top_t) {
+            result = top_t;
         }
 
         return result;
@@ -403,11 +553,27 @@ public:
     float get_reflection_coeff(const Vec3&) const override {
         return reflection_coeff;
     }
+
+    float max_reflection_coeff() const override {
+        return reflection_coeff;
+    }
+
+    std::optional<AABB> bounding_box() const override {
+        Vec3 half = disc_extent(axis_dir, radius);
+        Vec3 top_center = base_center + axis_dir * height;
+        AABB box(base_center - half, base_center + half);
+        box.expand(AABB(top_center - half, top_center + half));
+        return box;
+    }
+
+    void translate(const Vec3& offset) override {
+        base_center += offset;
+        bounds.translate(offset);
+    }
 };
 
 
-class Cone : public Object {
-// this class doesn't work if axis is not parallel to one of the axes
+class Cone : public HitObject {
 private:
     Vec3 base_center;      
     Vec3 axis;             
@@ -417,8 +583,12 @@ private:
 
     Vec3 vertex;    
 
+    BoundingSphere bounds;
+
+    friend class ReferenceTracer;
+
 private:
-    std::optional<Vec3> intersect_side(const Vec3& line_point, const Vec3& line_dir) const {
+    std::optional<float> hit_side(const Vec3& line_point, const Vec3& line_dir, float t_max) const {
         Vec3 v = line_point - vertex;
         float cos2 = height * height / (height * height + radius * radius);
 
@@ -440,7 +610,7 @@ private:
             t = std::max(t1, t2);
         }
 
-        if (t < 1e-6) {
+        if (t < 1e-6 || t >= t_max) {
             return std::nullopt;
         }
 
@@ -450,37 +620,36 @@ private:
             return std::nullopt;
         }
 
-        return hit_point;
+        return t;
     }
 
-    std::optional<Vec3> intersect_base(const Vec3& line_point, const Vec3& line_dir) const {
+    std::optional<float> hit_base(const Vec3& line_point, const Vec3& line_dir, float t_max) const {
         float denom = axis.dot(line_dir);
         if (fabs(denom) < 1e-6) {
             return std::nullopt;
         }
 
         float t = (base_center - line_point).dot(axis) / denom;
-        if (t < 1e-6) {
+        if (t < 1e-6 || t >= t_max) {
             return std::nullopt;
         }
 
-        Vec3 hit_point = line_point + line_dir * t;
-
-        if ((hit_point - base_center).norm() > radius) {
+        if ((line_point + line_dir * t - base_center).norm() > radius) {
             return std::nullopt;
         }
 
-        return hit_point;
-    }       
+        return t;
+    }
 
 public:
     Cone(const Vec3& base_center, const Vec3& axis, float radius, float height, float refl_coeff = 0.5)
         : base_center(base_center), 
-          axis(axis.normalized()), 
+          axis(axis.normalized_checked()), 
           radius(radius), 
           height(height), 
           reflection_coeff(refl_coeff),
-          vertex(base_center + axis * height) {
+          vertex(base_center + this->axis * height),
+          bounds(base_center + this->axis * (height/2), std::sqrt(radius * radius + height * height / 4)) {
         if (fabs(axis.norm()) < 1e-6) {
             throw std::runtime_error("Axis cannot be a zero vector");
         }
@@ -489,18 +658,14 @@ public:
         }
     }
 
-    std::optional<Vec3> intersection(const Vec3& line_point, const Vec3& line_dir) const override {
-        std::optional<Vec3> side_hit = intersect_side(line_point, line_dir);
-
-        std::optional<Vec3> base_hit = intersect_base(line_point, line_dir);
-
-        if (side_hit && base_hit) {
-            float side_dist = (*side_hit - line_point).norm();
-            float base_dist = (*base_hit - line_point).norm();
-            return (side_dist < base_dist) ? side_hit : base_hit;
+    std::optional<float> hit(const Vec3& line_point, const Vec3& line_dir, float t_max = INFINITY) const override {
+        if (!bounds.may_hit(line_point, line_dir, t_max)) {
+            return std::nullopt;
         }
 
-        return side_hit ? side_hit : base_hit;
+        std::optional<float> side_t = hit_side(line_point, line_dir, t_max);
+        std::optional<float> base_t = hit_base(line_point, line_dir, side_t ? side_t.value() : t_max);
+        return base_t ? base_t : side_t;
     }
 
     Vec3 norm_dir(const Vec3& point) const override {
@@ -517,6 +682,23 @@ public:
     float get_reflection_coeff(const Vec3&) const override {
         return reflection_coeff;
     }
+
+    float max_reflection_coeff() const override {
+        return reflection_coeff;
+    }
+
+    std::optional<AABB> bounding_box() const override {
+        Vec3 half = disc_extent(axis, radius);
+        AABB box(base_center - half, base_center + half);
+        box.expand(vertex);
+        return box;
+    }
+
+    void translate(const Vec3& offset) override {
+        base_center += offset;
+        vertex += offset;
+        bounds.translate(offset);
+    }
 };
 
 
@@ -0,0 +1,116 @@
+#ifndef OUTPUT_SINK_H_INCLUDED
+#define OUTPUT_SINK_H_INCLUDED
+#include <vector>
+#include <algorithm>
+
+
+class OutputSink {
+public:
+    // screen holds width*height characters, row by row
+    virtual void present(const char* screen, int width, int height) = 0;
+    virtual ~OutputSink() {}
+};
+
+
+class FrameDiff {
+// Remembers the last presented frame and reports the runs of cells that changed since then.
+// Runs in the same row separated by at most merge_gap unchanged cells are joined, because rewriting
+// a few cells is cheaper than another cursor move.
+private:
+    std::vector<char> previous;
+    int width = 0;
+    int height = 0;
+    float full_redraw_fraction;
+    int merge_gap;
+
+public:
+    explicit FrameDiff(float full_redraw_fraction = 0.5, int merge_gap = 8)
+        : full_redraw_fraction(full_redraw_fraction), merge_gap(merge_gap) {}
+
+    // Calls emit_span(row, col, length) for the changed runs and returns true, or returns false
+    // if the whole frame has to be redrawn (first frame, new size, too many changed cells).
+    template <class F>
+    bool diff(const char* screen, int width, int height, F&& emit_span) {
+        const int size = width * height;
+        bool full_redraw = width != this->width || height != this->height;
+
+        if (!full_redraw) {
+            int changed = 0;
+            for (int k = 0; k < size; ++k) {
+                changed += screen[k] != previous[k];
+            }
+            full_redraw = changed > full_redraw_fraction * size;
+        }
+
+        if (!full_redraw) {
+            for (int i = 0; i < height; ++i) {
+                const char* row = screen + i * width;
+                const char* prev_row = previous.data() + i * width;
+                int j = 0;
+                while (j < width) {
+                    while (j < width && row[j] == prev_row[j]) ++j;
+                    if (j == width) break;
+                    int begin = j;
+                    int end = j + 1;
+                    for (j = end; j < width && j - end <= merge_gap; ++j) {
+                        if (row[j] != prev_row[j]) end = j + 1;
+                    }
+                    j = end;
+                    emit_span(i, begin, end - begin);
+                }
+            }
+        }
+
+        previous.assign(screen, screen + size);
+        this->width = width;
+        this->height = height;
+        return !full_redraw;
+    }
+
+    void reset() {
+        width = 0;
+        height = 0;
+        previous.clear();
+    }
+};
+
+
+class NullSink : public OutputSink {
+public:
+    void present(const char*, int, int) override {}
+};
+
+
+class MemorySink : public OutputSink {
+private:
+    std::vector<char> frame;
+    int width = 0;
+    int height = 0;
+    long long frame_count = 0;
+
+public:
+    void present(const char* screen, int width, int height) override {
+        frame.assign(screen, screen + width * height);
+        this->width = width;
+        this->height = height;
+        ++frame_count;
+    }
+
+    const std::vector<char>& get_frame() const {
+        return frame;
+    }
+
+    int get_width() const {
+        return width;
+    }
+
+    int get_height() const {
+        return height;
+    }
+
+    long long get_frame_count() const {
+        return frame_count;
+    }
+};
+
+#endif //OUTPUT_SINK_H_INCLUDED
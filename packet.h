@@ -0,0 +1,551 @@
+#ifndef PACKET_H_INCLUDED
+#define PACKET_H_INCLUDED
+#include "tools.h"
+#include "objects.h"
+#include "object_store.h"
+#include "bvh.h"
+#include "profile.h"
+#include <vector>
+#include <cstring>
+
+// The packet kernels use GCC/Clang vector types, one lane per ray. Other compilers (MSVC), or a build with
+// -DRT_VECTOR_PACKETS=0, trace the lanes of a packet one by one through the same BVH and scalar intersection code.
+#ifndef RT_VECTOR_PACKETS
+#if defined(__GNUC__)
+#define RT_VECTOR_PACKETS 1
+#else
+#define RT_VECTOR_PACKETS 0
+#endif
+#endif
+
+// On x86 the vector tracer is compiled twice, for AVX2 and for the baseline, and the first packet picks the version
+// the CPU supports. GCC and Clang do this on Linux, macOS and 32-bit MinGW; GCC does not keep the stack 32-byte
+// aligned for AVX spills on 64-bit Windows, so MinGW-w64 GCC builds keep the baseline unless built with -mavx2.
+#if RT_VECTOR_PACKETS && (defined(__x86_64__) || defined(__i386__)) && !(defined(_WIN64) && !defined(__clang__))
+#define RT_SIMD_DISPATCH 1
+#else
+#define RT_SIMD_DISPATCH 0
+#endif
+
+#if defined(__GNUC__)
+#define RT_ALWAYS_INLINE __attribute__((always_inline)) inline
+#elif defined(_MSC_VER)
+#define RT_ALWAYS_INLINE __forceinline
+#else
+#define RT_ALWAYS_INLINE inline
+#endif
+
+#if RT_VECTOR_PACKETS && defined(__SSE__)
+#include <immintrin.h>
+#elif RT_VECTOR_PACKETS && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+
+struct RayPacket {
+// coherent rays sharing one origin (primary rays), stored lane by lane
+    static constexpr int max_size = 16;
+
+    int size = 0;
+    Vec3 origin;
+    alignas(64) float dir_x[max_size];
+    alignas(64) float dir_y[max_size];
+    alignas(64) float dir_z[max_size];
+    alignas(64) float t[max_size];       // nearest hit found so far
+    alignas(64) int primitive[max_size]; // its index in PacketScene, -1 for a miss
+
+    Vec3 get_dir(int k) const {
+        return Vec3(dir_x[k], dir_y[k], dir_z[k]);
+    }
+
+    void set_dir(int k, const Vec3& dir) {
+        dir_x[k] = dir.x;
+        dir_y[k] = dir.y;
+        dir_z[k] = dir.z;
+    }
+};
+
+
+#if RT_VECTOR_PACKETS
+template <int N>
+struct Lanes {
+    typedef float Float __attribute__((vector_size(N * sizeof(float))));
+    typedef int Int __attribute__((vector_size(N * sizeof(int))));
+
+    Float dir_x, dir_y, dir_z;
+    Float inv_x, inv_y, inv_z;
+    Float t;
+    Int primitive;
+
+    // vector values are passed by reference only, so no function signature depends on the vector ABI
+
+    template <class V, class T>
+    static RT_ALWAYS_INLINE void load(V& v, const T* data) {
+        std::memcpy(&v, data, sizeof(v));
+    }
+
+    template <class V, class T>
+    static RT_ALWAYS_INLINE void store(T* data, const V& v) {
+        std::memcpy(data, &v, sizeof(v));
+    }
+
+    // square root of every lane, negative lanes taken as 0; on x86 four lanes per sqrtps, which the AVX2 copy of
+    // the tracer encodes as VEX vsqrtps, on AArch64 four per fsqrt
+    static RT_ALWAYS_INLINE void sqrt(Float& x) {
+        x = x > 0 ? x : Float{};
+#if defined(__SSE__)
+        for (int k = 0; k < N; k += 4) {
+            __m128 part;
+            std::memcpy(&part, reinterpret_cast<const float*>(&x) + k, sizeof(part));
+            part = _mm_sqrt_ps(part);
+            std::memcpy(reinterpret_cast<float*>(&x) + k, &part, sizeof(part));
+        }
+#elif defined(__aarch64__)
+        for (int k = 0; k < N; k += 4) {
+            float32x4_t part;
+            std::memcpy(&part, reinterpret_cast<const float*>(&x) + k, sizeof(part));
+            part = vsqrtq_f32(part);
+            std::memcpy(reinterpret_cast<float*>(&x) + k, &part, sizeof(part));
+        }
+#else
+        for (int k = 0; k < N; ++k) {
+            x[k] = __builtin_sqrtf(x[k]);
+        }
+#endif
+    }
+
+    static RT_ALWAYS_INLINE void inverse(Float& x) {
+        x = 1 / (x == 0 ? Float{} + 1e-30f : x);
+    }
+
+    static RT_ALWAYS_INLINE void slab(const Float& t0, const Float& t1, Float& t_near, Float& t_far) {
+        t_near = t0 < t1 ? (t0 > t_near ? t0 : t_near) : (t1 > t_near ? t1 : t_near);
+        t_far = t0 < t1 ? (t1 < t_far ? t1 : t_far) : (t0 < t_far ? t0 : t_far);
+    }
+
+    RT_ALWAYS_INLINE void update(const Int& hit, const Float& new_t, int id) {
+        t = hit ? new_t : t;
+        primitive = hit ? Int{} + id : primitive;
+    }
+};
+#endif
+
+
+class PacketScene {
+// SoA copies of the sphere, plane, cylinder and box parameters of a Scene. Primitives are numbered like the
+// Scene's BVH (bounded objects first, then the unbounded ones); other object types are traced lane by lane.
+private:
+    enum Kind { SPHERE, PLANE, CYLINDER, BOX, GENERIC };
+
+    struct Primitive {
+        Kind kind;
+        int slot;
+    };
+
+    struct Spheres {
+        std::vector<float> center_x, center_y, center_z, radius;
+    } spheres;
+
+    struct Planes {
+        std::vector<float> point_x, point_y, point_z, norm_x, norm_y, norm_z;
+    } planes;
+
+    struct Cylinders {
+        std::vector<float> base_x, base_y, base_z, axis_x, axis_y, axis_z, radius, height;
+    } cylinders;
+
+    struct Boxes {
+        // center and the three local axes (height, width, length) with the half extents along them
+        std::vector<float> center_x, center_y, center_z;
+        std::vector<float> u_x, u_y, u_z, v_x, v_y, v_z, w_x, w_y, w_z;
+        std::vector<float> half_u, half_v, half_w;
+    } boxes;
+
+    std::vector<Primitive> primitives;
+    std::vector<ObjectRef> objects;
+    int num_bounded = 0;
+
+    // stores value at slot, the slot after the last one appends
+    static void put(std::vector<float>& values, int slot, float value) {
+        if (slot == static_cast<int>(values.size())) {
+            values.push_back(value);
+        } else {
+            values[slot] = value;
+        }
+    }
+
+    void write_plane(int slot, const Vec3& point, const Vec3& norm) {
+        put(planes.point_x, slot, point.x);
+        put(planes.point_y, slot, point.y);
+        put(planes.point_z, slot, point.z);
+        put(planes.norm_x, slot, norm.x);
+        put(planes.norm_y, slot, norm.y);
+        put(planes.norm_z, slot, norm.z);
+    }
+
+    // copies the parameters of an object to the slot of its primitive
+    void write(const ObjectRef& obj, const Primitive& primitive) {
+        const int slot = primitive.slot;
+        if (obj.kind == ObjectRef::SPHERE) {
+            const Sphere& s = static_cast<const Sphere&>(*obj.object);
+            put(spheres.center_x, slot, s.center.x);
+            put(spheres.center_y, slot, s.center.y);
+            put(spheres.center_z, slot, s.center.z);
+            put(spheres.radius, slot, s.radius);
+        } else if (obj.kind == ObjectRef::PLANE) {
+            const Plane& p = static_cast<const Plane&>(*obj.object);
+            write_plane(slot, p.point, p.norm);
+        } else if (obj.kind == ObjectRef::CHESS_PLANE) {
+            const ChessPlane& p = static_cast<const ChessPlane&>(*obj.object);
+            write_plane(slot, p.point, p.norm);
+        } else if (obj.kind == ObjectRef::CYLINDER) {
+            const Cylinder& c = static_cast<const Cylinder&>(*obj.object);
+            put(cylinders.base_x, slot, c.base_center.x);
+            put(cylinders.base_y, slot, c.base_center.y);
+            put(cylinders.base_z, slot, c.base_center.z);
+            put(cylinders.axis_x, slot, c.axis_dir.x);
+            put(cylinders.axis_y, slot, c.axis_dir.y);
+            put(cylinders.axis_z, slot, c.axis_dir.z);
+            put(cylinders.radius, slot, c.radius);
+            put(cylinders.height, slot, c.height);
+        } else if (obj.kind == ObjectRef::RECT_PRISM || obj.kind == ObjectRef::CUBE) {
+            const RectPrism& r = static_cast<const RectPrism&>(*obj.object);
+            Vec3 center = r.base_center + r.height_dir * (r.height/2);
+            put(boxes.center_x, slot, center.x);
+            put(boxes.center_y, slot, center.y);
+            put(boxes.center_z, slot, center.z);
+            put(boxes.u_x, slot, r.height_dir.x);
+            put(boxes.u_y, slot, r.height_dir.y);
+            put(boxes.u_z, slot, r.height_dir.z);
+            put(boxes.v_x, slot, r.width_dir.x);
+            put(boxes.v_y, slot, r.width_dir.y);
+            put(boxes.v_z, slot, r.width_dir.z);
+            put(boxes.w_x, slot, r.length_dir.x);
+            put(boxes.w_y, slot, r.length_dir.y);
+            put(boxes.w_z, slot, r.length_dir.z);
+            put(boxes.half_u, slot, r.height/2);
+            put(boxes.half_v, slot, r.width/2);
+            put(boxes.half_w, slot, r.length/2);
+        }
+    }
+
+    void add(const ObjectRef& obj) {
+        Primitive primitive = {GENERIC, 0};
+        switch (obj.kind) {
+            case ObjectRef::SPHERE: primitive = {SPHERE, static_cast<int>(spheres.radius.size())}; break;
+            case ObjectRef::PLANE:
+            case ObjectRef::CHESS_PLANE: primitive = {PLANE, static_cast<int>(planes.point_x.size())}; break;
+            case ObjectRef::CYLINDER: primitive = {CYLINDER, static_cast<int>(cylinders.radius.size())}; break;
+            case ObjectRef::RECT_PRISM:
+            case ObjectRef::CUBE: primitive = {BOX, static_cast<int>(boxes.half_u.size())}; break;
+            default: break;
+        }
+        write(obj, primitive);
+
+        primitives.push_back(primitive);
+        objects.push_back(obj);
+    }
+
+#if RT_VECTOR_PACKETS
+    template <int N>
+    RT_ALWAYS_INLINE void intersect_sphere(Lanes<N>& rays, const Vec3& origin, int slot, int id) const {
+        using Float = typename Lanes<N>::Float;
+        const float oc_x = origin.x - spheres.center_x[slot];
+        const float oc_y = origin.y - spheres.center_y[slot];
+        const float oc_z = origin.z - spheres.center_z[slot];
+        const float r = spheres.radius[slot];
+        const float c = oc_x * oc_x + oc_y * oc_y + oc_z * oc_z - r * r;
+
+        Float a = rays.dir_x * rays.dir_x + rays.dir_y * rays.dir_y + rays.dir_z * rays.dir_z;
+        Float b = 2 * (oc_x * rays.dir_x + oc_y * rays.dir_y + oc_z * rays.dir_z);
+        Float discriminant = b * b - 4 * a * c;
+        Float root = discriminant;
+        Lanes<N>::sqrt(root);
+        Float t1 = (-b - root) / (2 * a);
+        Float t2 = (-b + root) / (2 * a);
+        Float t = t1 > 0 ? t1 : t2;
+        rays.update((discriminant >= 0) & (t > 0) & (t < rays.t), t, id);
+    }
+
+    template <int N>
+    RT_ALWAYS_INLINE void intersect_plane(Lanes<N>& rays, const Vec3& origin, int slot, int id) const {
+        using Float = typename Lanes<N>::Float;
+        const float n_x = planes.norm_x[slot];
+        const float n_y = planes.norm_y[slot];
+        const float n_z = planes.norm_z[slot];
+        const float num = n_x * (planes.point_x[slot] - origin.x) + n_y * (planes.point_y[slot] - origin.y) + n_z * (planes.point_z[slot] - origin.z);
+
+        Float denom = n_x * rays.dir_x + n_y * rays.dir_y + n_z * rays.dir_z;
+        Float t = num / denom;
+        rays.update(((denom >= 1e-6f) | (denom <= -1e-6f)) & (t > 0) & (t < rays.t), t, id);
+    }
+
+    template <int N>
+    RT_ALWAYS_INLINE void intersect_cylinder(Lanes<N>& rays, const Vec3& origin, int slot, int id) const {
+        using Float = typename Lanes<N>::Float;
+        const float a_x = cylinders.axis_x[slot];
+        const float a_y = cylinders.axis_y[slot];
+        const float a_z = cylinders.axis_z[slot];
+        const float r = cylinders.radius[slot];
+        const float h = cylinders.height[slot];
+        const float oc_x = origin.x - cylinders.base_x[slot];
+        const float oc_y = origin.y - cylinders.base_y[slot];
+        const float oc_z = origin.z - cylinders.base_z[slot];
+        const float oc_a = oc_x * a_x + oc_y * a_y + oc_z * a_z;
+        const float o_x = oc_x - a_x * oc_a;
+        const float o_y = oc_y - a_y * oc_a;
+        const float o_z = oc_z - a_z * oc_a;
+        const float c = o_x * o_x + o_y * o_y + o_z * o_z - r * r;
+
+        // ray components along the axis and across it
+        Float d_a = rays.dir_x * a_x + rays.dir_y * a_y + rays.dir_z * a_z;
+        Float d_x = rays.dir_x - a_x * d_a;
+        Float d_y = rays.dir_y - a_y * d_a;
+        Float d_z = rays.dir_z - a_z * d_a;
+
+        Float qa = d_x * d_x + d_y * d_y + d_z * d_z;
+        Float qb = 2 * (d_x * o_x + d_y * o_y + d_z * o_z);
+        Float discriminant = qb * qb - 4 * qa * c;
+        Float root = discriminant;
+        Lanes<N>::sqrt(root);
+        Float t0 = (-qb - root) / (2 * qa);
+        Float t1 = (-qb + root) / (2 * qa);
+        Float t_side = t0 > 0 ? t0 : t1;
+        Float projection = oc_a + t_side * d_a;
+        Float best = (discriminant >= 0) & (t_side >= 0) & (projection >= 0) & (projection <= h) ? t_side : Float{} + INFINITY;
+
+        // caps at heights 0 and h along the axis
+        auto not_parallel = (d_a >= 1e-6f) | (d_a <= -1e-6f);
+        Float t_bottom = -oc_a / d_a;
+        Float t_top = (h - oc_a) / d_a;
+        Float rb_x = o_x + d_x * t_bottom, rb_y = o_y + d_y * t_bottom, rb_z = o_z + d_z * t_bottom;
+        Float rt_x = o_x + d_x * t_top, rt_y = o_y + d_y * t_top, rt_z = o_z + d_z * t_top;
+        auto bottom_hit = not_parallel & (t_bottom >= 0) & (rb_x * rb_x + rb_y * rb_y + rb_z * rb_z <= r * r);
+        auto top_hit = not_parallel & (t_top >= 0) & (rt_x * rt_x + rt_y * rt_y + rt_z * rt_z <= r * r);
+        best = bottom_hit & (t_bottom < best) ? t_bottom : best;
+        best = top_hit & (t_top < best) ? t_top : best;
+
+        rays.update(best < rays.t, best, id);
+    }
+
+    template <int N>
+    RT_ALWAYS_INLINE void intersect_box(Lanes<N>& rays, const Vec3& origin, int slot, int id) const {
+        using Float = typename Lanes<N>::Float;
+        const float oc_x = origin.x - boxes.center_x[slot];
+        const float oc_y = origin.y - boxes.center_y[slot];
+        const float oc_z = origin.z - boxes.center_z[slot];
+        const float u_x = boxes.u_x[slot], u_y = boxes.u_y[slot], u_z = boxes.u_z[slot];
+        const float v_x = boxes.v_x[slot], v_y = boxes.v_y[slot], v_z = boxes.v_z[slot];
+        const float w_x = boxes.w_x[slot], w_y = boxes.w_y[slot], w_z = boxes.w_z[slot];
+        const float o_u = oc_x * u_x + oc_y * u_y + oc_z * u_z;
+        const float o_v = oc_x * v_x + oc_y * v_y + oc_z * v_z;
+        const float o_w = oc_x * w_x + oc_y * w_y + oc_z * w_z;
+        const float half_u = boxes.half_u[slot];
+        const float half_v = boxes.half_v[slot];
+        const float half_w = boxes.half_w[slot];
+
+        Float inv_u = rays.dir_x * u_x + rays.dir_y * u_y + rays.dir_z * u_z;
+        Float inv_v = rays.dir_x * v_x + rays.dir_y * v_y + rays.dir_z * v_z;
+        Float inv_w = rays.dir_x * w_x + rays.dir_y * w_y + rays.dir_z * w_z;
+        Lanes<N>::inverse(inv_u);
+        Lanes<N>::inverse(inv_v);
+        Lanes<N>::inverse(inv_w);
+
+        Float t_near = Float{} - INFINITY;
+        Float t_far = Float{} + INFINITY;
+        Lanes<N>::slab((-half_u - o_u) * inv_u, (half_u - o_u) * inv_u, t_near, t_far);
+        Lanes<N>::slab((-half_v - o_v) * inv_v, (half_v - o_v) * inv_v, t_near, t_far);
+        Lanes<N>::slab((-half_w - o_w) * inv_w, (half_w - o_w) * inv_w, t_near, t_far);
+
+        Float t = t_near > 0 ? t_near : t_far;
+        rays.update((t_near <= t_far) & (t > 0) & (t < rays.t), t, id);
+    }
+
+    template <int N>
+    void intersect_generic(Lanes<N>& rays, const RayPacket& packet, int id) const {
+        float best_t[N];
+        int best_primitive[N];
+        Lanes<N>::store(best_t, rays.t);
+        Lanes<N>::store(best_primitive, rays.primitive);
+        for (int k = 0; k < N; ++k) {
+            auto t = ObjectStore::hit(objects[id], packet.origin, packet.get_dir(k), best_t[k]);
+            if (t) {
+                best_t[k] = t.value();
+                best_primitive[k] = id;
+            }
+        }
+        Lanes<N>::load(rays.t, best_t);
+        Lanes<N>::load(rays.primitive, best_primitive);
+    }
+
+    template <int N>
+    RT_ALWAYS_INLINE void intersect(Lanes<N>& rays, const RayPacket& packet, int id) const {
+        const Primitive& primitive = primitives[id];
+        RT_PROFILE_ADD(packet_tests[objects[id].kind], 1);
+        switch (primitive.kind) {
+            case SPHERE: intersect_sphere<N>(rays, packet.origin, primitive.slot, id); break;
+            case PLANE: intersect_plane<N>(rays, packet.origin, primitive.slot, id); break;
+            case CYLINDER: intersect_cylinder<N>(rays, packet.origin, primitive.slot, id); break;
+            case BOX: intersect_box<N>(rays, packet.origin, primitive.slot, id); break;
+            case GENERIC: intersect_generic<N>(rays, packet, id); break;
+        }
+    }
+
+    template <int N>
+    static RT_ALWAYS_INLINE bool hit_box(const Lanes<N>& rays, const Vec3& origin, const AABB& box) {
+        using Float = typename Lanes<N>::Float;
+        Float t_near = Float{};
+        Float t_far = rays.t;
+        Lanes<N>::slab((box.min.x - origin.x) * rays.inv_x, (box.max.x - origin.x) * rays.inv_x, t_near, t_far);
+        Lanes<N>::slab((box.min.y - origin.y) * rays.inv_y, (box.max.y - origin.y) * rays.inv_y, t_near, t_far);
+        Lanes<N>::slab((box.min.z - origin.z) * rays.inv_z, (box.max.z - origin.z) * rays.inv_z, t_near, t_far);
+        int hit[N];
+        Lanes<N>::store(hit, t_near <= t_far);
+        for (int k = 0; k < N; ++k) {
+            if (hit[k]) return true;
+        }
+        return false;
+    }
+
+    template <int N>
+    RT_ALWAYS_INLINE void trace_lanes(RayPacket& packet, const BVH& bvh) const {
+        for (int k = packet.size; k < N; ++k) {
+            packet.set_dir(k, packet.get_dir(packet.size - 1));
+        }
+
+        Lanes<N> rays;
+        const Vec3 origin = packet.origin;
+        Lanes<N>::load(rays.dir_x, packet.dir_x);
+        Lanes<N>::load(rays.dir_y, packet.dir_y);
+        Lanes<N>::load(rays.dir_z, packet.dir_z);
+        rays.inv_x = rays.dir_x;
+        rays.inv_y = rays.dir_y;
+        rays.inv_z = rays.dir_z;
+        Lanes<N>::inverse(rays.inv_x);
+        Lanes<N>::inverse(rays.inv_y);
+        Lanes<N>::inverse(rays.inv_z);
+        rays.t = typename Lanes<N>::Float{} + INFINITY;
+        rays.primitive = typename Lanes<N>::Int{} - 1;
+
+        for (int id = num_bounded; id < static_cast<int>(primitives.size()); ++id) {
+            intersect<N>(rays, packet, id);
+        }
+
+        const std::vector<BVH::Node>& nodes = bvh.get_nodes();
+        if (!nodes.empty() && hit_box<N>(rays, origin, nodes[0].bounds)) {
+            int stack[BVH::max_depth];
+            int stack_size = 0;
+            int node_index = 0;
+            while (true) {
+                const BVH::Node& node = nodes[node_index];
+                RT_PROFILE_ADD(packet_bvh_nodes, 1);
+                if (node.count > 0) {
+                    for (int i = node.offset; i < node.offset + node.count; ++i) {
+                        intersect<N>(rays, packet, bvh.get_primitive(i));
+                    }
+                } else {
+                    int left = node_index + 1;
+                    int right = node.offset;
+                    bool hit_left = hit_box<N>(rays, origin, nodes[left].bounds);
+                    bool hit_right = hit_box<N>(rays, origin, nodes[right].bounds);
+                    if (hit_left || hit_right) {
+                        if (hit_left && hit_right) stack[stack_size++] = right;
+                        node_index = hit_left ? left : right;
+                        continue;
+                    }
+                }
+                if (stack_size == 0) break;
+                node_index = stack[--stack_size];
+            }
+        }
+
+        Lanes<N>::store(packet.t, rays.t);
+        Lanes<N>::store(packet.primitive, rays.primitive);
+    }
+
+    RT_ALWAYS_INLINE void trace_sizes(RayPacket& packet, const BVH& bvh) const {
+        if (packet.size <= 4) {
+            trace_lanes<4>(packet, bvh);
+        } else if (packet.size <= 8) {
+            trace_lanes<8>(packet, bvh);
+        } else {
+            trace_lanes<16>(packet, bvh);
+        }
+    }
+#endif
+
+#if RT_SIMD_DISPATCH
+    __attribute__((target("avx2")))
+    void trace_avx2(RayPacket& packet, const BVH& bvh) const {
+        trace_sizes(packet, bvh);
+    }
+
+    static bool has_avx2() {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+    }
+#endif
+
+public:
+    PacketScene() {}
+
+    void build(const std::vector<ObjectRef>& bounded_objects, const std::vector<ObjectRef>& unbounded_objects) {
+        spheres = Spheres();
+        planes = Planes();
+        cylinders = Cylinders();
+        boxes = Boxes();
+        primitives.clear();
+        objects.clear();
+
+        for (const ObjectRef& obj : bounded_objects) add(obj);
+        for (const ObjectRef& obj : unbounded_objects) add(obj);
+        num_bounded = static_cast<int>(bounded_objects.size());
+    }
+
+    // refreshes the copy of an object that moved since build
+    void update(int id) {
+        write(objects[id], primitives[id]);
+    }
+
+    ObjectRef get_object(int id) const {
+        return objects[id];
+    }
+
+    // Finds the nearest primitive for every lane; the directions must be normalized.
+    // bvh is the hierarchy the bounded objects were numbered by.
+    void trace(RayPacket& packet, const BVH& bvh) const {
+#if RT_VECTOR_PACKETS
+#if RT_SIMD_DISPATCH
+        static const bool avx2 = has_avx2();
+        if (avx2) {
+            trace_avx2(packet, bvh);
+            return;
+        }
+#endif
+        trace_sizes(packet, bvh);
+#else
+        for (int k = 0; k < packet.size; ++k) {
+            const Vec3 dir = packet.get_dir(k);
+            float t_max = INFINITY;
+            int nearest = -1;
+            auto test = [&](int id) {
+                RT_PROFILE_ADD(packet_tests[objects[id].kind], 1);
+                auto t = ObjectStore::hit(objects[id], packet.origin, dir, t_max);
+                if (t) {
+                    t_max = t.value();
+                    nearest = id;
+                }
+                return false;
+            };
+            for (int id = num_bounded; id < static_cast<int>(primitives.size()); ++id) {
+                test(id);
+            }
+            bvh.traverse(packet.origin, dir, t_max, test);
+            packet.t[k] = t_max;
+            packet.primitive[k] = nearest;
+        }
+#endif
+    }
+};
+
+#endif //PACKET_H_INCLUDED
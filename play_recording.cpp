@@ -0,0 +1,52 @@
+#include "recording.h"
+#include "terminal_sink.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+//
+// Plays a recording made with RecordingWriter (see batch_render.cpp) in the terminal at a fixed frame rate,
+// without raytracing.
+//
+// usage: play_recording FILE [--fps N] [--loop 0|1]
+
+
+int main(int argc, char** argv) {
+    if (argc < 2 || argc % 2 != 0) {
+        std::fprintf(stderr, "usage: %s FILE [--fps N] [--loop 0|1]\n", argv[0]);
+        return 2;
+    }
+    int fps = 0;
+    bool loop = true;
+    for (int k = 2; k + 1 < argc; k += 2) {
+        std::string arg = argv[k];
+        if (arg == "--fps") fps = std::atoi(argv[k + 1]);
+        else if (arg == "--loop") loop = std::atoi(argv[k + 1]) != 0;
+        else {
+            std::fprintf(stderr, "unknown option %s\n", arg.c_str());
+            return 2;
+        }
+    }
+
+    try {
+        Recording recording(argv[1]);
+        if (fps <= 0) {
+            fps = recording.get_frame_rate();
+        }
+        auto sink = make_terminal_sink();
+        const auto frame_time = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / fps));
+        auto next = std::chrono::steady_clock::now();
+        do {
+            for (int frame = 0; frame < recording.get_num_frames(); ++frame) {
+                sink->present(recording.get_frame(frame), recording.get_width(), recording.get_height());
+                next += frame_time;
+                std::this_thread::sleep_until(next);
+            }
+        } while (loop && recording.get_num_frames() > 0);
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,82 @@
+#ifndef PROFILE_H_INCLUDED
+#define PROFILE_H_INCLUDED
+#include "object_store.h"
+#include <deque>
+#include <mutex>
+
+
+// Work counters of the tracing code. They are counted only when the program is compiled with RT_PROFILE
+// defined (-DRT_PROFILE), otherwise RT_PROFILE_ADD expands to nothing and every counter stays 0.
+struct ProfileCounters {
+    static constexpr int num_kinds = ObjectRef::CUSTOM + 1;
+
+    long long intersection_tests[num_kinds] = {}; // scalar ray tests by object kind
+    long long packet_tests[num_kinds] = {};       // packet tests by object kind, one per packet
+    long long hint_tests = 0;                     // shadow rays tested against the occluder cached for the pixel
+    long long bvh_nodes = 0;                      // nodes visited by scalar rays, in the scene's and the meshes' BVHs
+    long long packet_bvh_nodes = 0;
+    long long triangle_tests = 0;
+
+    ProfileCounters& operator+=(const ProfileCounters& other) {
+        for (int k = 0; k < num_kinds; ++k) {
+            intersection_tests[k] += other.intersection_tests[k];
+            packet_tests[k] += other.packet_tests[k];
+        }
+        hint_tests += other.hint_tests;
+        bvh_nodes += other.bvh_nodes;
+        packet_bvh_nodes += other.packet_bvh_nodes;
+        triangle_tests += other.triangle_tests;
+        return *this;
+    }
+
+    static const char* kind_name(int kind) {
+        static const char* const names[num_kinds] = {"plane", "chess_plane", "sphere", "rect", "rect_prism", "cube",
+                                                     "cylinder", "cone", "custom"};
+        return names[kind];
+    }
+};
+
+
+class Profiler {
+// Every thread counts into a block of its own, so counting is a plain increment. collect() sums and clears
+// the blocks; it must run while no thread is tracing, between frames, which the thread pool's join orders.
+private:
+    static std::mutex& registry_mutex() {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    static std::deque<ProfileCounters>& blocks() {
+        static std::deque<ProfileCounters> blocks;
+        return blocks;
+    }
+
+    static ProfileCounters* register_thread() {
+        std::lock_guard<std::mutex> lock(registry_mutex());
+        return &blocks().emplace_back();
+    }
+
+public:
+    static ProfileCounters& local() {
+        thread_local ProfileCounters* counters = register_thread();
+        return *counters;
+    }
+
+    static ProfileCounters collect() {
+        std::lock_guard<std::mutex> lock(registry_mutex());
+        ProfileCounters total;
+        for (ProfileCounters& counters : blocks()) {
+            total += counters;
+            counters = ProfileCounters();
+        }
+        return total;
+    }
+};
+
+#ifdef RT_PROFILE
+#define RT_PROFILE_ADD(counter, value) (Profiler::local().counter += (value))
+#else
+#define RT_PROFILE_ADD(counter, value) ((void)0)
+#endif
+
+#endif //PROFILE_H_INCLUDED
@@ -0,0 +1,335 @@
+#ifndef RECORDING_H_INCLUDED
+#define RECORDING_H_INCLUDED
+#include "output_sink.h"
+#include "mapped_file.h"
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+
+// Recording file, for replaying rendered frames without tracing them:
+//   header  - 8-byte magic, width, height, frame rate and keyframe interval as 32-bit integers
+//   frames  - every frame as runs of (count as a varint, byte): a keyframe holds the characters of the frame,
+//             any other frame the XOR of its characters with the previous frame, so unchanged cells are zero runs
+//   index   - per frame its offset (64-bit), encoded size (32-bit) and 1 for a keyframe, 0 otherwise (32-bit)
+//   trailer - offset of the index (64-bit), number of frames (32-bit) and the magic again
+// Integers are little-endian.
+struct RecordingFormat {
+    static constexpr char magic[8] = {'R', 'T', 'R', 'E', 'C', '0', '0', '1'};
+    static constexpr size_t header_size = sizeof(magic) + 16;
+    static constexpr size_t index_entry_size = 16;
+    static constexpr size_t trailer_size = 12 + sizeof(magic);
+
+    static void put_u32(std::vector<unsigned char>& out, uint32_t value) {
+        for (int k = 0; k < 4; ++k) {
+            out.push_back(static_cast<unsigned char>(value >> (8 * k)));
+        }
+    }
+
+    static void put_u64(std::vector<unsigned char>& out, uint64_t value) {
+        put_u32(out, static_cast<uint32_t>(value));
+        put_u32(out, static_cast<uint32_t>(value >> 32));
+    }
+
+    static uint32_t get_u32(const unsigned char* in) {
+        return in[0] | (in[1] << 8) | (in[2] << 16) | (static_cast<uint32_t>(in[3]) << 24);
+    }
+
+    static uint64_t get_u64(const unsigned char* in) {
+        return get_u32(in) | (static_cast<uint64_t>(get_u32(in + 4)) << 32);
+    }
+
+    // appends the runs of equal bytes of data as (varint count, byte) pairs
+    static void encode_runs(const unsigned char* data, size_t size, std::vector<unsigned char>& out) {
+        for (size_t k = 0; k < size;) {
+            size_t run = 1;
+            while (k + run < size && data[k + run] == data[k]) ++run;
+            for (size_t count = run; ; count >>= 7) {
+                if (count < 0x80) {
+                    out.push_back(static_cast<unsigned char>(count));
+                    break;
+                }
+                out.push_back(static_cast<unsigned char>(count & 0x7f) | 0x80);
+            }
+            out.push_back(data[k]);
+            k += run;
+        }
+    }
+};
+
+
+// Output sink that records the presented frames; the file can be played once finish() has written its index.
+// A frame becomes a keyframe every keyframe_interval frames, or sooner when its delta would be larger.
+class RecordingWriter : public OutputSink {
+private:
+    struct IndexEntry {
+        uint64_t offset;
+        uint32_t size;
+        bool keyframe;
+    };
+
+    FILE* file;
+    int width = 0;
+    int height = 0;
+    int frame_rate;
+    int keyframe_interval;
+    int since_keyframe = 0;
+    uint64_t offset = 0;
+    bool finished = false;
+
+    std::vector<IndexEntry> index;
+    std::vector<unsigned char> previous;
+    std::vector<unsigned char> xor_frame;
+    std::vector<unsigned char> key_record;
+    std::vector<unsigned char> delta_record;
+
+    void write(const std::vector<unsigned char>& bytes) {
+        if (std::fwrite(bytes.data(), 1, bytes.size(), file) != bytes.size()) {
+            throw std::runtime_error("Cannot write recording");
+        }
+        offset += bytes.size();
+    }
+
+    void write_header() {
+        std::vector<unsigned char> header(RecordingFormat::magic, RecordingFormat::magic + sizeof(RecordingFormat::magic));
+        RecordingFormat::put_u32(header, static_cast<uint32_t>(width));
+        RecordingFormat::put_u32(header, static_cast<uint32_t>(height));
+        RecordingFormat::put_u32(header, static_cast<uint32_t>(frame_rate));
+        RecordingFormat::put_u32(header, static_cast<uint32_t>(keyframe_interval));
+        write(header);
+    }
+
+public:
+    explicit RecordingWriter(const std::string& path, int frame_rate = 30, int keyframe_interval = 60)
+        : frame_rate(frame_rate), keyframe_interval(keyframe_interval) {
+        if (frame_rate <= 0 || keyframe_interval <= 0) {
+            throw std::invalid_argument("Frame rate and keyframe interval must be positive");
+        }
+        file = std::fopen(path.c_str(), "wb");
+        if (!file) {
+            throw std::runtime_error("Cannot open " + path);
+        }
+    }
+
+    RecordingWriter(const RecordingWriter&) = delete;
+    RecordingWriter& operator=(const RecordingWriter&) = delete;
+
+    void present(const char* screen, int width, int height) override {
+        if (finished) {
+            throw std::logic_error("Recording is already finished");
+        }
+        const size_t size = static_cast<size_t>(width) * height;
+        const unsigned char* frame = reinterpret_cast<const unsigned char*>(screen);
+        if (index.empty()) {
+            this->width = width;
+            this->height = height;
+            write_header();
+        } else if (width != this->width || height != this->height) {
+            throw std::invalid_argument("All frames of a recording must have the same size");
+        }
+
+        key_record.clear();
+        RecordingFormat::encode_runs(frame, size, key_record);
+        bool keyframe = index.empty() || since_keyframe + 1 >= keyframe_interval;
+        if (!keyframe) {
+            xor_frame.resize(size);
+            for (size_t k = 0; k < size; ++k) {
+                xor_frame[k] = frame[k] ^ previous[k];
+            }
+            delta_record.clear();
+            RecordingFormat::encode_runs(xor_frame.data(), size, delta_record);
+            keyframe = delta_record.size() >= key_record.size();
+        }
+
+        const std::vector<unsigned char>& record = keyframe ? key_record : delta_record;
+        index.push_back({offset, static_cast<uint32_t>(record.size()), keyframe});
+        write(record);
+        since_keyframe = keyframe ? 0 : since_keyframe + 1;
+        previous.assign(frame, frame + size);
+    }
+
+    // writes the index and closes the file
+    void finish() {
+        if (finished) return;
+        finished = true;
+        if (index.empty()) {
+            write_header();
+        }
+        std::vector<unsigned char> tail;
+        const uint64_t index_offset = offset;
+        for (const IndexEntry& entry : index) {
+            RecordingFormat::put_u64(tail, entry.offset);
+            RecordingFormat::put_u32(tail, entry.size);
+            RecordingFormat::put_u32(tail, entry.keyframe ? 1 : 0);
+        }
+        RecordingFormat::put_u64(tail, index_offset);
+        RecordingFormat::put_u32(tail, static_cast<uint32_t>(index.size()));
+        tail.insert(tail.end(), RecordingFormat::magic, RecordingFormat::magic + sizeof(RecordingFormat::magic));
+        write(tail);
+        if (std::fclose(file) != 0) {
+            file = nullptr;
+            throw std::runtime_error("Cannot write recording");
+        }
+        file = nullptr;
+    }
+
+    long long get_frame_count() const {
+        return static_cast<long long>(index.size());
+    }
+
+    ~RecordingWriter() {
+        try {
+            finish();
+        } catch (const std::exception&) {
+            // a destructor can't report it, call finish() to know
+        }
+        if (file) std::fclose(file);
+    }
+};
+
+
+// A recording mapped into memory. Frames are decoded straight from the mapping into one screen buffer:
+// playing forward costs one delta per frame, a seek decodes from the nearest keyframe before the frame.
+class Recording {
+private:
+    MappedFile file;
+    const unsigned char* data;
+    const unsigned char* index;
+    int width;
+    int height;
+    int frame_rate;
+    int num_frames;
+    uint64_t index_offset;
+
+    std::vector<char> screen;
+    int current = -1; // frame held by screen
+
+    void fail() const {
+        throw std::runtime_error("Corrupt recording");
+    }
+
+    uint64_t frame_offset(int frame) const {
+        return RecordingFormat::get_u64(index + frame * RecordingFormat::index_entry_size);
+    }
+
+    uint32_t frame_size(int frame) const {
+        return RecordingFormat::get_u32(index + frame * RecordingFormat::index_entry_size + 8);
+    }
+
+    // overwrites the screen with the runs of a keyframe or XORs the runs of a delta into it;
+    // zero runs of a delta are unchanged cells and are skipped
+    void apply(int frame) {
+        const uint64_t begin = frame_offset(frame);
+        const uint64_t size = frame_size(frame);
+        if (begin < RecordingFormat::header_size || begin > index_offset || size > index_offset - begin) fail();
+        const unsigned char* in = data + begin;
+        const unsigned char* end = in + size;
+        const bool keyframe = is_keyframe(frame);
+
+        size_t pos = 0;
+        while (in < end) {
+            size_t count = 0;
+            int shift = 0;
+            while (true) {
+                if (in == end || shift > 28) fail();
+                unsigned char byte = *in++;
+                count |= static_cast<size_t>(byte & 0x7f) << shift;
+                if (byte < 0x80) break;
+                shift += 7;
+            }
+            if (in == end || count > screen.size() - pos) fail();
+            const unsigned char value = *in++;
+            if (keyframe) {
+                std::memset(screen.data() + pos, value, count);
+            } else if (value != 0) {
+                for (size_t k = pos; k < pos + count; ++k) {
+                    screen[k] = static_cast<char>(screen[k] ^ value);
+                }
+            }
+            pos += count;
+        }
+        if (pos != screen.size()) fail();
+    }
+
+public:
+    explicit Recording(const std::string& path): file(path) {
+        data = reinterpret_cast<const unsigned char*>(file.get_data());
+        const size_t size = file.get_size();
+        const size_t magic_size = sizeof(RecordingFormat::magic);
+        if (size < RecordingFormat::header_size + RecordingFormat::trailer_size ||
+            std::memcmp(data, RecordingFormat::magic, magic_size) != 0 ||
+            std::memcmp(data + size - magic_size, RecordingFormat::magic, magic_size) != 0) {
+            throw std::runtime_error(path + " is not a finished recording");
+        }
+
+        // the header values must fit an int, as the writer's did; the frame rate must be positive, as the writer
+        // requires, and the frame size must fit an int too, as sinks index it that way
+        const uint32_t raw_width = RecordingFormat::get_u32(data + magic_size);
+        const uint32_t raw_height = RecordingFormat::get_u32(data + magic_size + 4);
+        const uint32_t raw_frame_rate = RecordingFormat::get_u32(data + magic_size + 8);
+        if (raw_width > INT_MAX || raw_height > INT_MAX || raw_frame_rate == 0 || raw_frame_rate > INT_MAX ||
+            (raw_height > 0 && raw_width > INT_MAX / raw_height)) {
+            fail();
+        }
+        width = static_cast<int>(raw_width);
+        height = static_cast<int>(raw_height);
+        frame_rate = static_cast<int>(raw_frame_rate);
+        const unsigned char* trailer = data + size - RecordingFormat::trailer_size;
+        index_offset = RecordingFormat::get_u64(trailer);
+        num_frames = static_cast<int>(RecordingFormat::get_u32(trailer + 8));
+        if (num_frames < 0 || index_offset < RecordingFormat::header_size ||
+            index_offset + static_cast<uint64_t>(num_frames) * RecordingFormat::index_entry_size + RecordingFormat::trailer_size != size) {
+            fail();
+        }
+        index = data + index_offset;
+        screen.resize(static_cast<size_t>(width) * height);
+    }
+
+    Recording(const Recording&) = delete;
+    Recording& operator=(const Recording&) = delete;
+
+    // width*height characters of the frame, valid until the next call
+    const char* get_frame(int frame) {
+        if (frame < 0 || frame >= num_frames) {
+            throw std::out_of_range("Frame out of range");
+        }
+        if (frame != current) {
+            // decoding goes on from the frame held now when it's before the requested one
+            const int resume = current >= 0 && current < frame ? current + 1 : -1;
+            int from = frame;
+            while (from != resume && from >= 0 && !is_keyframe(from)) --from;
+            if (from < 0) fail();
+            for (int k = from; k <= frame; ++k) {
+                apply(k);
+            }
+            current = frame;
+        }
+        return screen.data();
+    }
+
+    bool is_keyframe(int frame) const {
+        return RecordingFormat::get_u32(index + frame * RecordingFormat::index_entry_size + 12) != 0;
+    }
+
+    int get_num_frames() const {
+        return num_frames;
+    }
+
+    int get_width() const {
+        return width;
+    }
+
+    int get_height() const {
+        return height;
+    }
+
+    int get_frame_rate() const {
+        return frame_rate;
+    }
+};
+
+#endif //RECORDING_H_INCLUDED
@@ -0,0 +1,431 @@
+#ifndef REFERENCE_TRACER_H_INCLUDED
+#define REFERENCE_TRACER_H_INCLUDED
+#include "tools.h"
+#include "objects.h"
+#include "camera_and_light.h"
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <vector>
+
+
+class ReferenceTracer {
+// The tracer of the first render_frame, kept as it was to check the engine's faster paths against
+// (bench --verify): every ray is tested against every object and every pixel is shaded on its own, with no BVH,
+// packets, caches or early exits. The intersection code of the built-in objects, the nearest-point search by
+// distance and the direction to each pixel are copies of the first versions, reading the objects' and the
+// camera's fields; objects of other kinds (meshes, instances, user types) are asked for their intersection.
+// What the engine draws may only change here first; optimizations never go here.
+private:
+    static constexpr char gradient[] = " .:!/r(l1Z4H9W8$@";
+    static constexpr int gradient_size = sizeof(gradient) - 1;
+
+    enum class Kind { other, plane, chess_plane, sphere, rect, rect_prism, cylinder, cone };
+
+    struct Entry {
+        std::unique_ptr<Object> object;
+        Kind kind;
+    };
+
+    std::vector<Entry> objects;
+    const int num_reflections;
+
+    static Kind kind_of(const Object& obj) {
+        if (dynamic_cast<const Plane*>(&obj)) return Kind::plane;
+        if (dynamic_cast<const ChessPlane*>(&obj)) return Kind::chess_plane;
+        if (dynamic_cast<const Sphere*>(&obj)) return Kind::sphere;
+        if (dynamic_cast<const Rect*>(&obj)) return Kind::rect;
+        if (dynamic_cast<const RectPrism*>(&obj)) return Kind::rect_prism;
+        if (dynamic_cast<const Cylinder*>(&obj)) return Kind::cylinder;
+        if (dynamic_cast<const Cone*>(&obj)) return Kind::cone;
+        return Kind::other;
+    }
+
+    static std::optional<Vec3> plane_intersection(const Vec3& point, const Vec3& norm, const Vec3& line_point, const Vec3& line_dir) {
+        if (fabs(norm.dot(line_dir)) < 1e-6) {
+            return std::nullopt;
+        }
+
+        float t = norm.dot(point - line_point) / norm.dot(line_dir);
+
+        if (t > 0) {
+            return line_point + line_dir * t;
+        }
+
+        return std::nullopt;
+    }
+
+    static std::optional<Vec3> sphere_intersection(const Sphere& sphere, const Vec3& line_point, const Vec3& line_dir) {
+        Vec3 oc = line_point - sphere.center;
+        float a = line_dir.dot(line_dir);
+        float b = 2.0 * oc.dot(line_dir);
+        float c = oc.dot(oc) - sphere.radius * sphere.radius;
+
+        float discriminant = b * b - 4 * a * c;
+
+        if (discriminant > 0) {
+            float t1 = (-b - sqrt(discriminant)) / (2.0 * a);
+            float t2 = (-b + sqrt(discriminant)) / (2.0 * a);
+            Vec3 intersection1 = line_point + line_dir * t1;
+            Vec3 intersection2 = line_point + line_dir * t2;
+            if (t1 > 0 && t2 > 0) {
+                return t1 < t2 ? intersection1 : intersection2;
+            } else if (t1 > 0) {
+                return intersection1;
+            } else if (t2 > 0) {
+                return intersection2;
+            }
+        } else if (discriminant == 0) {
+            float t = -b / (2.0 * a);
+            if (t > 0) {
+                return line_point + line_dir * t;
+            }
+        }
+
+        return std::nullopt;
+    }
+
+    static std::optional<Vec3> rect_intersection(const Vec3& center, const Vec3& norm, const Vec3& width_dir, const Vec3& height_dir,
+                                                 float width, float height, const Vec3& line_point, const Vec3& line_dir) {
+        if (fabs(norm.dot(line_dir)) < 1e-6) {
+            return std::nullopt;
+        }
+
+        float t = norm.dot(center - line_point) / norm.dot(line_dir);
+
+        if (t > 0) {
+            Vec3 possible_intersection = line_point + line_dir * t;
+            Vec3 local_point = possible_intersection - center;
+            if (fabs(width_dir.dot(local_point)) < width/2 && fabs(height_dir.dot(local_point)) < height/2) {
+                return possible_intersection;
+            }
+        }
+
+        return std::nullopt;
+    }
+
+    // the nearest of the six faces, each a Rect made as the prism's constructor used to make them
+    static std::optional<Vec3> rect_prism_intersection(const RectPrism& prism, const Vec3& line_point, const Vec3& line_dir) {
+        struct Face {
+            Vec3 center, norm, width_dir;
+            float width, height;
+        };
+        const Vec3& base_center = prism.base_center;
+        const Vec3& height_dir = prism.height_dir;
+        const Vec3& width_dir = prism.width_dir;
+        const Vec3& length_dir = prism.length_dir;
+        const float height = prism.height, width = prism.width, length = prism.length;
+        const Face faces[6] = {
+            {base_center, -height_dir, width_dir, width, length},
+            {base_center + height_dir*height, height_dir, width_dir, width, length},
+            {base_center - length_dir*(length/2) + height_dir*(height/2), -length_dir, width_dir, width, height},
+            {base_center + length_dir*(length/2) + height_dir*(height/2), length_dir, width_dir, width, height},
+            {base_center - width_dir*(width/2) + height_dir*(height/2), -width_dir, length_dir, length, height},
+            {base_center + width_dir*(width/2) + height_dir*(height/2), width_dir, length_dir, length, height},
+        };
+
+        float closest = std::numeric_limits<float>::max();
+        std::optional<Vec3> closest_intersection = std::nullopt;
+
+        for (const auto& face : faces) {
+            auto face_intersection = rect_intersection(face.center, face.norm.normalized(), face.width_dir.normalized(),
+                                                       face.norm.cross(face.width_dir).normalized(), face.width, face.height,
+                                                       line_point, line_dir);
+            if (face_intersection) {
+                float t = (face_intersection.value() - line_point).norm();
+                if (t < closest) {
+                    closest = t;
+                    closest_intersection = face_intersection;
+                }
+            }
+        }
+
+        return closest_intersection;
+    }
+
+    static std::optional<Vec3> cylinder_side_intersection(const Cylinder& cylinder, const Vec3& line_point, const Vec3& line_dir) {
+        const Vec3& axis_dir = cylinder.axis_dir;
+        Vec3 oc = line_point - cylinder.base_center;
+        Vec3 d = line_dir - axis_dir * line_dir.dot(axis_dir);
+        Vec3 o = oc - axis_dir * oc.dot(axis_dir);
+
+        float a = d.dot(d);
+        float b = 2.0 * d.dot(o);
+        float c = o.dot(o) - cylinder.radius * cylinder.radius;
+
+        float discriminant = b * b - 4 * a * c;
+        if (discriminant < 0) {
+            return std::nullopt;
+        }
+
+        float t0 = (-b - sqrt(discriminant)) / (2 * a);
+        float t1 = (-b + sqrt(discriminant)) / (2 * a);
+
+        float t = (t0 > 0) ? t0 : t1;
+        if (t < 0) {
+            return std::nullopt;
+        }
+
+        Vec3 intersection = line_point + line_dir * t;
+        float projection_length = (intersection - cylinder.base_center).dot(axis_dir);
+
+        if (projection_length < 0 || projection_length > cylinder.height) {
+            return std::nullopt;
+        }
+
+        return intersection;
+    }
+
+    static std::optional<Vec3> cylinder_base_intersection(const Cylinder& cylinder, const Vec3& line_point, const Vec3& line_dir, const Vec3& base_center) {
+        Vec3 base_norm = cylinder.axis_dir;
+        if (fabs(base_norm.dot(line_dir)) < 1e-6) {
+            return std::nullopt;
+        }
+
+        float t = base_norm.dot(base_center - line_point) / base_norm.dot(line_dir);
+        if (t < 0) {
+            return std::nullopt;
+        }
+
+        Vec3 intersection = line_point + line_dir * t;
+        if ((intersection - base_center).norm() <= cylinder.radius) {
+            return intersection;
+        }
+
+        return std::nullopt;
+    }
+
+    static std::optional<Vec3> cylinder_intersection(const Cylinder& cylinder, const Vec3& line_point, const Vec3& line_dir) {
+        auto side_intersection = cylinder_side_intersection(cylinder, line_point, line_dir);
+
+        auto bottom_intersection = cylinder_base_intersection(cylinder, line_point, line_dir, cylinder.base_center);
+
+        Vec3 top_center = cylinder.base_center + cylinder.axis_dir * cylinder.height;
+        auto top_intersection = cylinder_base_intersection(cylinder, line_point, line_dir, top_center);
+
+        std::optional<Vec3> result = std::nullopt;
+        float min_t = std::numeric_limits<float>::max();
+
+        for (const auto& candidate : {side_intersection, bottom_intersection, top_intersection}) {
+            if (candidate) {
+                float t = (candidate.value() - line_point).norm();
+                if (t < min_t) {
+                    min_t = t;
+                    result = candidate;
+                }
+            }
+        }
+
+        return result;
+    }
+
+    static std::optional<Vec3> cone_side_intersection(const Cone& cone, const Vec3& line_point, const Vec3& line_dir) {
+        const Vec3& axis = cone.axis;
+        const float height = cone.height, radius = cone.radius;
+        Vec3 v = line_point - cone.vertex;
+        float cos2 = height * height / (height * height + radius * radius);
+
+        float a = line_dir.dot(axis) * line_dir.dot(axis) - cos2 * line_dir.dot(line_dir);
+        float b = 2 * (line_dir.dot(axis) * v.dot(axis) - cos2 * line_dir.dot(v));
+        float c = v.dot(axis) * v.dot(axis) - cos2 * v.dot(v);
+
+        float discriminant = b * b - 4 * a * c;
+
+        if (discriminant < 0) {
+            return std::nullopt;
+        }
+
+        float t1 = (-b - sqrt(discriminant)) / (2 * a);
+        float t2 = (-b + sqrt(discriminant)) / (2 * a);
+
+        float t = std::min(t1, t2);
+        if (t < 1e-6) {
+            t = std::max(t1, t2);
+        }
+
+        if (t < 1e-6) {
+            return std::nullopt;
+        }
+
+        Vec3 hit_point = line_point + line_dir * t;
+
+        if ((hit_point - cone.base_center).dot(axis) < 0 || (hit_point - cone.vertex).dot(-axis) < 0) {
+            return std::nullopt;
+        }
+
+        return hit_point;
+    }
+
+    static std::optional<Vec3> cone_base_intersection(const Cone& cone, const Vec3& line_point, const Vec3& line_dir) {
+        float denom = cone.axis.dot(line_dir);
+        if (fabs(denom) < 1e-6) {
+            return std::nullopt;
+        }
+
+        float t = (cone.base_center - line_point).dot(cone.axis) / denom;
+        if (t < 1e-6) {
+            return std::nullopt;
+        }
+
+        Vec3 hit_point = line_point + line_dir * t;
+
+        if ((hit_point - cone.base_center).norm() > cone.radius) {
+            return std::nullopt;
+        }
+
+        return hit_point;
+    }
+
+    static std::optional<Vec3> cone_intersection(const Cone& cone, const Vec3& line_point, const Vec3& line_dir) {
+        std::optional<Vec3> side_hit = cone_side_intersection(cone, line_point, line_dir);
+
+        std::optional<Vec3> base_hit = cone_base_intersection(cone, line_point, line_dir);
+
+        if (side_hit && base_hit) {
+            float side_dist = (*side_hit - line_point).norm();
+            float base_dist = (*base_hit - line_point).norm();
+            return (side_dist < base_dist) ? side_hit : base_hit;
+        }
+
+        return side_hit ? side_hit : base_hit;
+    }
+
+    static std::optional<Vec3> intersection(const Entry& entry, const Vec3& line_point, const Vec3& line_dir) {
+        const Object& obj = *entry.object;
+        switch (entry.kind) {
+            case Kind::plane: {
+                const Plane& plane = static_cast<const Plane&>(obj);
+                return plane_intersection(plane.point, plane.norm, line_point, line_dir);
+            }
+            case Kind::chess_plane: {
+                const ChessPlane& plane = static_cast<const ChessPlane&>(obj);
+                return plane_intersection(plane.point, plane.norm, line_point, line_dir);
+            }
+            case Kind::sphere:
+                return sphere_intersection(static_cast<const Sphere&>(obj), line_point, line_dir);
+            case Kind::rect: {
+                const Rect& rect = static_cast<const Rect&>(obj);
+                return rect_intersection(rect.center, rect.norm, rect.width_dir, rect.height_dir, rect.width, rect.height, line_point, line_dir);
+            }
+            case Kind::rect_prism:
+                return rect_prism_intersection(static_cast<const RectPrism&>(obj), line_point, line_dir);
+            case Kind::cylinder:
+                return cylinder_intersection(static_cast<const Cylinder&>(obj), line_point, line_dir);
+            case Kind::cone:
+                return cone_intersection(static_cast<const Cone&>(obj), line_point, line_dir);
+            case Kind::other:
+                break;
+        }
+        return obj.intersection(line_point, line_dir);
+    }
+
+    const Object* nearest_intersection(const Vec3& line_point, const Vec3& line_dir, const Object* excluded_obj, Vec3& intersection_point) const {
+        float min_dist = INFINITY;
+        const Object* nearest = nullptr;
+        for (const auto& entry : objects) {
+            if (entry.object.get() == excluded_obj) continue;
+            auto curr_intersection = intersection(entry, line_point, line_dir);
+            if (curr_intersection) {
+                float curr_dist = (curr_intersection.value() - line_point).norm();
+                if (curr_dist < min_dist) {
+                    min_dist = curr_dist;
+                    intersection_point = curr_intersection.value();
+                    nearest = entry.object.get();
+                }
+            }
+        }
+        return nearest;
+    }
+
+    bool is_shadow(const Vec3& line_point, const Vec3& line_dir, const Object* excluded_obj, float distance_to_light) const {
+        for (const auto& entry : objects) {
+            if (entry.object.get() == excluded_obj) continue;
+            auto curr_intersection = intersection(entry, line_point, line_dir);
+            if (curr_intersection) {
+                float curr_dist = (curr_intersection.value() - line_point).norm();
+                if (curr_dist < distance_to_light) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+public:
+    explicit ReferenceTracer(int num_reflections = 5): num_reflections(num_reflections) {}
+
+    Object& add_object(std::unique_ptr<Object> obj) {
+        const Kind kind = kind_of(*obj);
+        objects.push_back({std::move(obj), kind});
+        return *objects.back().object;
+    }
+
+    // direction of the ray to pixel (i, j), worked out from the camera's position, direction and screen for each pixel
+    static Vec3 dir_to_pixel(const Camera& camera, int i, int j) {
+        float y = static_cast<float>(i) / camera.height * 2 - 1;
+        float x = static_cast<float>(j) / camera.width * 2 - 1;
+        x *= camera.aspect * camera.pixel_aspect;
+
+        Vec3 screen_center = camera.position + camera.direction.normalized() * camera.camera_distance;
+
+        Vec3 right = camera.direction.cross(Vec3(0, 1, 0)).normalized();
+        Vec3 up = right.cross(camera.direction).normalized();
+        Vec3 pixel_point = screen_center + right * x + up * y;
+
+        return (pixel_point - camera.position).normalized();
+    }
+
+    char trace(const Vec3& position, const Vec3& dir, const Light& light) const {
+        const float max_intensity = 1;
+        float light_intensity = 0;
+        float cum_reflection_coeff = 1;
+        Vec3 ray_point = position;
+        Vec3 ray_dir = dir;
+        const Object* excluded_obj = nullptr;
+
+        for (int k = 0; k < num_reflections; ++k) {
+            Vec3 intersection;
+            const Object* intersection_obj = nearest_intersection(ray_point, ray_dir, excluded_obj, intersection);
+            if (!intersection_obj) {
+                break;
+            }
+            Vec3 norm_dir = intersection_obj->norm_dir(intersection);
+
+            Vec3 dir_to_light = (light.get_position() - intersection).normalized();
+            float cos_angle = norm_dir.dot(dir_to_light);
+
+            cum_reflection_coeff *= intersection_obj->get_reflection_coeff(intersection);
+
+            if (cos_angle > 0 && !is_shadow(intersection, dir_to_light, intersection_obj, (light.get_position() - intersection).norm())) {
+                light_intensity += cum_reflection_coeff*cos_angle*light.get_power();
+            }
+
+            ray_point = intersection;
+            ray_dir = (ray_dir - norm_dir*2*ray_dir.dot(norm_dir)).normalized();
+            excluded_obj = intersection_obj;
+        }
+
+        return gradient[std::min(static_cast<int>(light_intensity/max_intensity*gradient_size), gradient_size - 1)];
+    }
+
+    // the frame the camera sees, camera.get_width() * camera.get_height() characters
+    void render(const Camera& camera, const Light& light, char* screen) const {
+        const int width = camera.get_width();
+        const int height = camera.get_height();
+        for (int i = 0; i < height; ++i) {
+            for (int j = 0; j < width; ++j) {
+                screen[i*width + j] = trace(camera.get_position(), dir_to_pixel(camera, i, j), light);
+            }
+        }
+    }
+
+    // position of a character in the gradient, -1 for any other character
+    static int gradient_index(char c) {
+        for (int k = 0; k < gradient_size; ++k) {
+            if (gradient[k] == c) return k;
+        }
+        return -1;
+    }
+};
+
+#endif //REFERENCE_TRACER_H_INCLUDED
@@ -2,66 +2,275 @@
 #define SCENE_H_INCLUDED
 #include "tools.h"
 #include "objects.h"
+#include "object_store.h"
+#include "bvh.h"
+#include "packet.h"
+#include "profile.h"
 #include <vector>
 #include <tuple>
+#include <unordered_map>
+
+
+struct HitRecord {
+    float t; // hit point is line_point + line_dir*t
+    Object* object;
+    ObjectRef::Kind kind;
+
+    ObjectRef get_ref() const {
+        return {object, kind};
+    }
+};
 
 
 class Scene {
 private:
-    std::vector<Object*> objects;
+    ObjectStore store;
+    std::vector<ObjectRef> objects;
+
+    // acceleration structures: a BVH over the bounded objects, a list of the unbounded ones
+    // and SoA copies of both for packet tracing
+    std::vector<ObjectRef> bounded_objects;
+    std::vector<ObjectRef> unbounded_objects;
+    BVH bvh;
+    PacketScene packet_scene;
+    bool bvh_dirty = true;
+    unsigned revision = 0;
+
+    // objects moved since the last prepare, refitted into the BVH instead of rebuilding it
+    std::unordered_map<const Object*, int> packet_ids;
+    std::vector<const Object*> moved_objects;
+    float rebuild_threshold = 1.5;
+    float max_reflection_coeff = 0;
+
+    static AABB padded(const AABB& box) {
+        Vec3 pad(1e-4, 1e-4, 1e-4);
+        return AABB(box.min - pad, box.max + pad);
+    }
+
+    void rebuild() {
+        bounded_objects.clear();
+        unbounded_objects.clear();
+        std::vector<AABB> boxes;
+        max_reflection_coeff = 0;
+        for (const ObjectRef& obj : objects) {
+            max_reflection_coeff = std::fmax(max_reflection_coeff, obj.object->max_reflection_coeff());
+            auto box = obj.object->bounding_box();
+            if (box) {
+                boxes.push_back(padded(*box));
+                bounded_objects.push_back(obj);
+            } else {
+                unbounded_objects.push_back(obj);
+            }
+        }
+        bvh.build(boxes);
+        packet_scene.build(bounded_objects, unbounded_objects);
+
+        // packet scene ids: the bounded objects, numbered like the BVH primitives, then the unbounded ones
+        packet_ids.clear();
+        int id = 0;
+        for (const ObjectRef& obj : bounded_objects) packet_ids[obj.object] = id++;
+        for (const ObjectRef& obj : unbounded_objects) packet_ids[obj.object] = id++;
+    }
+
+    // returns false when the BVH has to be rebuilt instead: a moved object lost or gained its bounding box
+    // or the refitted tree got too costly
+    bool refit() {
+        for (const Object* obj : moved_objects) {
+            auto it = packet_ids.find(obj);
+            if (it == packet_ids.end()) return false;
+            int id = it->second;
+            auto box = obj->bounding_box();
+            bool bounded = id < static_cast<int>(bounded_objects.size());
+            if (bounded != box.has_value()) return false;
+            if (bounded) {
+                bvh.update(id, padded(*box));
+            }
+        }
+        for (const Object* obj : moved_objects) {
+            packet_scene.update(packet_ids[obj]);
+        }
+        bvh.refit();
+        return bvh.get_cost() <= bvh.get_build_cost() * rebuild_threshold;
+    }
 
 public:
     Scene() {}
 
+    // takes ownership of an object allocated with new, built-in or a custom Object subclass
     void add_object(Object* obj) {
-        objects.push_back(obj);
+        objects.push_back(store.add(obj));
+        bvh_dirty = true;
+        ++revision;
     }
 
-    std::optional<std::tuple<Vec3, Vec3, Object*>> get_nearest_intersection(const Vec3& line_point, const Vec3& line_dir, Object* excluded_obj = nullptr) const {
-        float min_dist = INFINITY;
-        Vec3 intersection;
-        Vec3 norm_dir;
-        Object* intersection_obj;
-        std::optional<Vec3> curr_intersection;
-        for(Object* obj : objects) {
-            if (obj == excluded_obj) continue;
-            curr_intersection = obj->intersection(line_point, line_dir);
-            if (curr_intersection) {
-                float curr_dist = (curr_intersection.value() - line_point).norm();
-                if (curr_dist < min_dist) {
-                    min_dist = curr_dist;
-                    intersection = curr_intersection.value();
-                    norm_dir = obj->norm_dir(intersection);
-                    intersection_obj = obj;
-                }
+    // moves or copies the object into the scene's own storage: scene.add_object(Sphere(center, radius, coeff))
+    template <class T, class U = typename std::decay<T>::type, class = typename std::enable_if<std::is_base_of<Object, U>::value>::type>
+    U& add_object(T&& obj) {
+        objects.push_back(store.emplace<U>(std::forward<T>(obj)));
+        bvh_dirty = true;
+        ++revision;
+        return static_cast<U&>(*objects.back().object);
+    }
+
+    // call after changing objects already in the scene in ways update_object doesn't cover;
+    // the next prepare() rebuilds the scene BVH while structures inside objects, like mesh BVHs, are kept
+    void invalidate() {
+        bvh_dirty = true;
+        moved_objects.clear();
+        ++revision;
+    }
+
+    // call after moving an object already in the scene, e.g. with Object::translate or Instance::set_transform;
+    // the next prepare() refits the BVH bounds over it instead of rebuilding the whole tree
+    void update_object(const Object* obj) {
+        if (!bvh_dirty) {
+            moved_objects.push_back(obj);
+        }
+        ++revision;
+    }
+
+    void move_object(Object* obj, const Vec3& offset) {
+        obj->translate(offset);
+        update_object(obj);
+    }
+
+    // prepare() rebuilds the BVH when refits have made its SAH cost this many times the cost after the last build
+    void set_rebuild_threshold(float threshold) {
+        if (threshold < 1) {
+            throw std::invalid_argument("Rebuild threshold must be at least 1");
+        }
+        rebuild_threshold = threshold;
+    }
+
+    // changes whenever the objects change, for caches that keep object pointers or results
+    unsigned get_revision() const {
+        return revision;
+    }
+
+    // largest reflection coefficient of any object as of the last prepare(), infinite if an object can't tell
+    float get_max_reflection_coeff() const {
+        return max_reflection_coeff;
+    }
+
+    // Must be called after the objects change and before rendering; queries fall back to a linear scan until then.
+    // Moved objects are refitted, the BVH is only rebuilt after additions or when refits have degraded it.
+    void prepare() {
+        if (!bvh_dirty && moved_objects.empty()) return;
+
+        if (bvh_dirty || !refit()) {
+            rebuild();
+        }
+        moved_objects.clear();
+        bvh_dirty = false;
+    }
+
+    // nearest object hit by the ray before t_max; the hit point and normal are left to the caller
+    std::optional<HitRecord> get_nearest_hit(const Vec3& line_point, const Vec3& line_dir, const Object* excluded_obj = nullptr, float t_max = INFINITY) const {
+        const ObjectRef* hit_obj = nullptr;
+
+        // BVH leaves mix object types, there a plain virtual call is cheaper than switching on the kind
+        auto test = [&](const ObjectRef& obj, bool in_leaf) {
+            if (obj.object == excluded_obj) return;
+            RT_PROFILE_ADD(intersection_tests[obj.kind], 1);
+            auto t = in_leaf ? obj.object->hit(line_point, line_dir, t_max) : ObjectStore::hit(obj, line_point, line_dir, t_max);
+            if (t) {
+                t_max = t.value();
+                hit_obj = &obj;
             }
+        };
+
+        if (bvh_dirty) {
+            for (const ObjectRef& obj : objects) test(obj, false);
+        } else {
+            for (const ObjectRef& obj : unbounded_objects) test(obj, false);
+            bvh.traverse(line_point, line_dir, t_max, [&](int prim) {
+                test(bounded_objects[prim], true);
+                return false;
+            });
         }
 
-        if (min_dist == INFINITY) {
+        if (!hit_obj) {
             return std::nullopt;
         }
 
-        return std::make_tuple(intersection, norm_dir, intersection_obj);
+        return HitRecord{t_max, hit_obj->object, hit_obj->kind};
     }
 
-    bool is_shadow(const Vec3& line_point, const Vec3& line_dir, const Object* excluded_obj, float distance_to_light) const {
-        for(Object* obj : objects) {
-            if (obj == excluded_obj) continue;
-            auto curr_intersection = obj->intersection(line_point, line_dir);
-            if (curr_intersection) {
-                float curr_dist = (curr_intersection.value() - line_point).norm();
-                if (curr_dist < distance_to_light) {
-                    return true;
-                }
+    std::optional<std::tuple<Vec3, Vec3, Object*>> get_nearest_intersection(const Vec3& line_point, const Vec3& line_dir, Object* excluded_obj = nullptr) const {
+        auto hit = get_nearest_hit(line_point, line_dir, excluded_obj);
+        if (!hit) {
+            return std::nullopt;
+        }
+
+        Vec3 intersection = line_point + line_dir * hit->t;
+        return std::make_tuple(intersection, ObjectStore::norm_dir(hit->get_ref(), intersection), hit->object);
+    }
+
+    // get_nearest_hit for a packet of rays starting at packet.origin with normalized directions
+    void get_nearest_hits(RayPacket& packet, std::optional<HitRecord>* result) const {
+        if (bvh_dirty) {
+            for (int k = 0; k < packet.size; ++k) {
+                result[k] = get_nearest_hit(packet.origin, packet.get_dir(k));
+            }
+            return;
+        }
+
+        packet_scene.trace(packet, bvh);
+        for (int k = 0; k < packet.size; ++k) {
+            if (packet.primitive[k] < 0) {
+                result[k] = std::nullopt;
+                continue;
+            }
+            // the winner is intersected once more with its own scalar code, so the hit point matches the scalar path
+            ObjectRef obj = packet_scene.get_object(packet.primitive[k]);
+            RT_PROFILE_ADD(intersection_tests[obj.kind], 1);
+            auto t = ObjectStore::hit(obj, packet.origin, packet.get_dir(k));
+            if (t) {
+                result[k] = HitRecord{t.value(), obj.object, obj.kind};
+            } else {
+                result[k] = get_nearest_hit(packet.origin, packet.get_dir(k));
             }
         }
-        return false;
     }
 
-    ~Scene() {
-        for(auto obj : objects) {
-            delete obj;
+    // Any object closer than the light along the ray, or nullptr when the light is visible.
+    // The hint, usually the occluder found for the same pixel before, is tested first.
+    const Object* get_occluder(const Vec3& line_point, const Vec3& line_dir, const Object* excluded_obj, float distance_to_light, const Object* hint = nullptr) const {
+        float t_max = distance_to_light / line_dir.norm();
+        RT_PROFILE_ADD(hint_tests, hint && hint != excluded_obj);
+        if (hint && hint != excluded_obj && hint->hit(line_point, line_dir, t_max)) {
+            return hint;
         }
+
+        const Object* occluder = nullptr;
+        auto test = [&](const ObjectRef& obj, bool in_leaf) {
+            if (obj.object == hint || obj.object == excluded_obj) return false;
+            RT_PROFILE_ADD(intersection_tests[obj.kind], 1);
+            if (in_leaf ? obj.object->hit(line_point, line_dir, t_max) : ObjectStore::hit(obj, line_point, line_dir, t_max)) {
+                occluder = obj.object;
+                return true;
+            }
+            return false;
+        };
+
+        if (bvh_dirty) {
+            for (const ObjectRef& obj : objects) {
+                if (test(obj, false)) break;
+            }
+            return occluder;
+        }
+
+        for (const ObjectRef& obj : unbounded_objects) {
+            if (test(obj, false)) return occluder;
+        }
+        bvh.traverse(line_point, line_dir, t_max, [&](int prim) {
+            return test(bounded_objects[prim], true);
+        });
+        return occluder;
+    }
+
+    bool is_shadow(const Vec3& line_point, const Vec3& line_dir, const Object* excluded_obj, float distance_to_light) const {
+        return get_occluder(line_point, line_dir, excluded_obj, distance_to_light) != nullptr;
     }
 };
 
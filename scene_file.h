@@ -0,0 +1,529 @@
+#ifndef SCENE_FILE_H_INCLUDED
+#define SCENE_FILE_H_INCLUDED
+#include "engine.h"
+#include "mapped_file.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <stdexcept>
+#include <sys/stat.h>
+
+
+// Records of the binary scene cache. The cache is the header followed by the settings and the arrays of
+// objects, paths and waypoints, stored exactly as they are used, in the byte order of the machine that wrote it.
+struct SceneCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_objects;
+    uint32_t num_paths;
+    uint32_t num_waypoints;
+    int64_t source_size; // size and modification time of the text file the cache was made from
+    int64_t source_time;
+};
+
+struct SceneSettings {
+    float camera_position[3];
+    float camera_direction[3];
+    float camera_fov;
+    float camera_orbit[3];       // rotation angles per frame, zero for a still camera
+    float camera_orbit_point[3];
+    int32_t camera_swing;        // frames between reversals of the orbit, 0 to keep turning one way
+    float light_position[3];
+    float light_power;
+    float light_orbit[3];
+    float light_orbit_point[3];
+};
+
+struct SceneObjectRecord {
+    int32_t kind;   // ObjectRef::Kind
+    int32_t path;   // index of the path the object follows, -1 for none
+    float values[13];
+};
+
+struct ScenePathRecord {
+    int32_t first_waypoint;
+    int32_t num_waypoints;
+    int32_t leg_frames;
+};
+
+struct SceneWaypoint {
+    float offset[3];
+};
+
+
+class SceneFile {
+// A scene described in a text file instead of code, one statement per line, '#' starts a comment:
+//
+//   camera <x y z> [direction <x y z>] [fov <degrees>]
+//   camera_orbit <angles per frame> [around <x y z>] [swing <frames>]
+//   light <x y z> [power <p>]
+//   light_orbit <angles per frame> [around <x y z>]
+//   material <name> <reflection coefficient>
+//   plane <point> <norm> <coeff>
+//   chess_plane <point> <norm> <square size> <black coeff> <white coeff>
+//   sphere <center> <radius> <coeff>
+//   rect <center> <norm> <width dir> <width> <height> <coeff>
+//   rect_prism <base center> <height dir> <width dir> <height> <width> <length> <coeff>
+//   cube <base center> <height dir> <width dir> <side> <coeff>
+//   cylinder <base center> <axis> <radius> <height> <coeff>
+//   cone <base center> <axis> <radius> <height> <coeff>
+//   path <frames per leg> <offset> [<offset> ...]
+//
+// Coefficients may be given by material name. A path moves the object above it through the offsets from its
+// starting position and back, in a loop. load() keeps a binary copy next to the text file and maps it instead
+// of parsing while the text file is unchanged.
+private:
+    static constexpr char magic[8] = {'R', 'T', 'S', 'C', 'E', 'N', 'E', 0};
+    static constexpr uint32_t version = 2;
+
+    struct ObjectSyntax {
+        const char* keyword;
+        ObjectRef::Kind kind;
+        int num_values;
+        int first_coeff; // the values from here on may be material names
+    };
+
+    static constexpr ObjectSyntax object_syntax[] = {
+        {"plane", ObjectRef::PLANE, 7, 6},
+        {"chess_plane", ObjectRef::CHESS_PLANE, 9, 7},
+        {"sphere", ObjectRef::SPHERE, 5, 4},
+        {"rect", ObjectRef::RECT, 12, 11},
+        {"rect_prism", ObjectRef::RECT_PRISM, 13, 12},
+        {"cube", ObjectRef::CUBE, 11, 10},
+        {"cylinder", ObjectRef::CYLINDER, 9, 8},
+        {"cone", ObjectRef::CONE, 9, 8},
+    };
+
+    static_assert(std::is_trivially_copyable<SceneSettings>::value && std::is_trivially_copyable<SceneObjectRecord>::value,
+                  "Scene cache records must be plain data");
+
+    // the cache image, either parsed into buffer or mapped from the cache file
+    std::vector<char> buffer;
+    std::shared_ptr<MappedFile> mapping;
+    bool from_cache = false;
+
+    std::vector<Object*> added; // object of every record, filled by apply
+    int frame = 0;
+
+    const char* data() const {
+        return mapping ? mapping->get_data() : buffer.data();
+    }
+
+    const SceneCacheHeader& get_header() const {
+        return *reinterpret_cast<const SceneCacheHeader*>(data());
+    }
+
+    const SceneSettings& get_settings() const {
+        return *reinterpret_cast<const SceneSettings*>(data() + sizeof(SceneCacheHeader));
+    }
+
+    const SceneObjectRecord* get_objects() const {
+        return reinterpret_cast<const SceneObjectRecord*>(data() + sizeof(SceneCacheHeader) + sizeof(SceneSettings));
+    }
+
+    const ScenePathRecord* get_paths() const {
+        return reinterpret_cast<const ScenePathRecord*>(get_objects() + get_header().num_objects);
+    }
+
+    const SceneWaypoint* get_waypoints() const {
+        return reinterpret_cast<const SceneWaypoint*>(get_paths() + get_header().num_paths);
+    }
+
+    static size_t image_size(const SceneCacheHeader& header) {
+        return sizeof(SceneCacheHeader) + sizeof(SceneSettings) + header.num_objects * sizeof(SceneObjectRecord) +
+               header.num_paths * sizeof(ScenePathRecord) + header.num_waypoints * sizeof(SceneWaypoint);
+    }
+
+    static Vec3 vec(const float* v) {
+        return Vec3(v[0], v[1], v[2]);
+    }
+
+    static void set_vec(float* v, const Vec3& value) {
+        v[0] = value.x;
+        v[1] = value.y;
+        v[2] = value.z;
+    }
+
+    // size and modification time of a file, false when it doesn't exist; the time as finely as the system keeps it
+    // (nanoseconds, or 100 ns units on Windows) so that an edit within the second the cache was written from is still noticed
+    static bool file_signature(const std::string& path, int64_t& size, int64_t& time) {
+#ifdef _WIN32
+        WIN32_FILE_ATTRIBUTE_DATA info;
+        if (!GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &info)) {
+            return false;
+        }
+        size = static_cast<int64_t>((static_cast<uint64_t>(info.nFileSizeHigh) << 32) | info.nFileSizeLow);
+        time = static_cast<int64_t>((static_cast<uint64_t>(info.ftLastWriteTime.dwHighDateTime) << 32) |
+                                    info.ftLastWriteTime.dwLowDateTime);
+#else
+        struct stat info;
+        if (stat(path.c_str(), &info) != 0) {
+            return false;
+        }
+        size = static_cast<int64_t>(info.st_size);
+#ifdef __APPLE__
+        const struct timespec& modified = info.st_mtimespec;
+#else
+        const struct timespec& modified = info.st_mtim;
+#endif
+        time = static_cast<int64_t>(modified.tv_sec) * 1000000000 + modified.tv_nsec;
+#endif
+        return true;
+    }
+
+    static std::string read_file(const std::string& path) {
+        FILE* file = std::fopen(path.c_str(), "rb");
+        if (!file) {
+            throw std::runtime_error("Cannot open " + path);
+        }
+        std::string text;
+        char chunk[1 << 16];
+        size_t n;
+        while ((n = std::fread(chunk, 1, sizeof(chunk), file)) > 0) {
+            text.append(chunk, n);
+        }
+        std::fclose(file);
+        return text;
+    }
+
+    // offset of a path at a frame: the path runs from the start through the waypoints and back
+    Vec3 path_offset(const ScenePathRecord& path, int at_frame) const {
+        const int legs = path.num_waypoints + 1;
+        const int t = at_frame % (legs * path.leg_frames);
+        const int leg = t / path.leg_frames;
+        const float f = static_cast<float>(t % path.leg_frames) / path.leg_frames;
+        const SceneWaypoint* waypoints = get_waypoints() + path.first_waypoint;
+        Vec3 from = leg == 0 ? Vec3() : vec(waypoints[leg - 1].offset);
+        Vec3 to = leg == legs - 1 ? Vec3() : vec(waypoints[leg].offset);
+        return from + (to - from) * f;
+    }
+
+    class Parser {
+    private:
+        const std::string& name;
+        int line_number = 0;
+        std::vector<std::string> tokens;
+        size_t next = 0;
+        std::map<std::string, float> materials;
+
+    public:
+        SceneSettings settings = {};
+        std::vector<SceneObjectRecord> objects;
+        std::vector<ScenePathRecord> paths;
+        std::vector<SceneWaypoint> waypoints;
+
+        explicit Parser(const std::string& name): name(name) {
+            set_vec(settings.camera_position, Vec3(0, 0, -1));
+            set_vec(settings.camera_direction, Vec3(0, 0, 1));
+            settings.camera_fov = 90;
+            set_vec(settings.light_position, Vec3(0, -100, -100));
+            settings.light_power = 1;
+        }
+
+        [[noreturn]] void fail(const std::string& message) const {
+            throw std::runtime_error(name + ":" + std::to_string(line_number) + ": " + message);
+        }
+
+        bool has_token() const {
+            return next < tokens.size();
+        }
+
+        const std::string& token() {
+            if (!has_token()) fail("unexpected end of line");
+            return tokens[next++];
+        }
+
+        float number(bool allow_material = false) {
+            const std::string& text = token();
+            char* end;
+            float value = std::strtof(text.c_str(), &end);
+            if (end != text.c_str() && *end == 0) {
+                return value;
+            }
+            auto material = materials.find(text);
+            if (allow_material && material != materials.end()) {
+                return material->second;
+            }
+            fail("bad number " + text);
+        }
+
+        void read_vec(float* v) {
+            for (int k = 0; k < 3; ++k) {
+                v[k] = number();
+            }
+        }
+
+        void parse_statement() {
+            const std::string keyword = token();
+            if (keyword == "camera") {
+                read_vec(settings.camera_position);
+                while (has_token()) {
+                    const std::string option = token();
+                    if (option == "direction") read_vec(settings.camera_direction);
+                    else if (option == "fov") settings.camera_fov = number();
+                    else fail("unknown camera option " + option);
+                }
+            } else if (keyword == "camera_orbit") {
+                read_vec(settings.camera_orbit);
+                while (has_token()) {
+                    const std::string option = token();
+                    if (option == "around") read_vec(settings.camera_orbit_point);
+                    else if (option == "swing") settings.camera_swing = static_cast<int32_t>(number());
+                    else fail("unknown camera_orbit option " + option);
+                }
+                if (settings.camera_swing < 0) fail("swing must not be negative");
+            } else if (keyword == "light") {
+                read_vec(settings.light_position);
+                while (has_token()) {
+                    const std::string option = token();
+                    if (option == "power") settings.light_power = number();
+                    else fail("unknown light option " + option);
+                }
+            } else if (keyword == "light_orbit") {
+                read_vec(settings.light_orbit);
+                while (has_token()) {
+                    const std::string option = token();
+                    if (option == "around") read_vec(settings.light_orbit_point);
+                    else fail("unknown light_orbit option " + option);
+                }
+            } else if (keyword == "material") {
+                const std::string material = token();
+                materials[material] = number();
+            } else if (keyword == "path") {
+                if (objects.empty()) fail("path before any object");
+                if (objects.back().path >= 0) fail("object already has a path");
+                ScenePathRecord path = {static_cast<int32_t>(waypoints.size()), 0, static_cast<int32_t>(number())};
+                if (path.leg_frames <= 0) fail("frames per leg must be positive");
+                while (has_token()) {
+                    SceneWaypoint waypoint;
+                    read_vec(waypoint.offset);
+                    waypoints.push_back(waypoint);
+                    ++path.num_waypoints;
+                }
+                if (path.num_waypoints == 0) fail("path needs at least one offset");
+                objects.back().path = static_cast<int32_t>(paths.size());
+                paths.push_back(path);
+            } else {
+                for (const ObjectSyntax& syntax : object_syntax) {
+                    if (keyword != syntax.keyword) continue;
+                    SceneObjectRecord record = {};
+                    record.kind = syntax.kind;
+                    record.path = -1;
+                    for (int k = 0; k < syntax.num_values; ++k) {
+                        record.values[k] = number(k >= syntax.first_coeff);
+                    }
+                    objects.push_back(record);
+                    return;
+                }
+                fail("unknown statement " + keyword);
+            }
+            if (has_token()) fail("unexpected " + token());
+        }
+
+        void parse(const std::string& text) {
+            const char* p = text.c_str();
+            const char* end = p + text.size();
+            while (p < end) {
+                const char* line_end = p;
+                while (line_end < end && *line_end != '\n') ++line_end;
+                ++line_number;
+
+                tokens.clear();
+                next = 0;
+                while (p < line_end && *p != '#') {
+                    if (*p == ' ' || *p == '\t' || *p == '\r') {
+                        ++p;
+                        continue;
+                    }
+                    const char* token_end = p;
+                    while (token_end < line_end && *token_end != ' ' && *token_end != '\t' && *token_end != '\r' && *token_end != '#') ++token_end;
+                    tokens.emplace_back(p, token_end);
+                    p = token_end;
+                }
+                if (!tokens.empty()) {
+                    parse_statement();
+                }
+                p = line_end + 1;
+            }
+        }
+    };
+
+    template <class T>
+    static void append(std::vector<char>& image, const T* values, size_t count) {
+        const char* bytes = reinterpret_cast<const char*>(values);
+        image.insert(image.end(), bytes, bytes + count * sizeof(T));
+    }
+
+public:
+    SceneFile() {}
+
+    // parses scene text; name is used in error messages
+    static SceneFile parse(const std::string& text, const std::string& name = "scene") {
+        Parser parser(name);
+        parser.parse(text);
+
+        SceneCacheHeader header = {};
+        std::memcpy(header.magic, magic, sizeof(magic));
+        header.version = version;
+        header.num_objects = static_cast<uint32_t>(parser.objects.size());
+        header.num_paths = static_cast<uint32_t>(parser.paths.size());
+        header.num_waypoints = static_cast<uint32_t>(parser.waypoints.size());
+
+        SceneFile scene_file;
+        scene_file.buffer.reserve(image_size(header));
+        append(scene_file.buffer, &header, 1);
+        append(scene_file.buffer, &parser.settings, 1);
+        append(scene_file.buffer, parser.objects.data(), parser.objects.size());
+        append(scene_file.buffer, parser.paths.data(), parser.paths.size());
+        append(scene_file.buffer, parser.waypoints.data(), parser.waypoints.size());
+        return scene_file;
+    }
+
+    // Maps the cache file path + ".cache" when it was made from the current text file, otherwise parses the text
+    // and writes the cache for the next time; a cache that can't be written only costs the speedup.
+    static SceneFile load(const std::string& path, bool use_cache = true) {
+        const std::string cache_path = path + ".cache";
+        int64_t source_size, source_time;
+        if (!file_signature(path, source_size, source_time)) {
+            throw std::runtime_error("Cannot open " + path);
+        }
+
+        if (use_cache) {
+            try {
+                SceneFile scene_file;
+                scene_file.mapping = std::make_shared<MappedFile>(cache_path);
+                const MappedFile& cache = *scene_file.mapping;
+                if (cache.get_size() >= sizeof(SceneCacheHeader)) {
+                    const SceneCacheHeader& header = scene_file.get_header();
+                    if (std::memcmp(header.magic, magic, sizeof(magic)) == 0 && header.version == version &&
+                        header.source_size == source_size && header.source_time == source_time &&
+                        image_size(header) == cache.get_size()) {
+                        scene_file.from_cache = true;
+                        return scene_file;
+                    }
+                }
+            } catch (const std::runtime_error&) {
+                // no cache yet
+            }
+        }
+
+        SceneFile scene_file = parse(read_file(path), path);
+        if (use_cache) {
+            SceneCacheHeader& header = *reinterpret_cast<SceneCacheHeader*>(scene_file.buffer.data());
+            header.source_size = source_size;
+            header.source_time = source_time;
+            scene_file.write_cache(cache_path);
+        }
+        return scene_file;
+    }
+
+    // writes the binary form through a temporary file, so a reader never maps a half written cache
+    bool write_cache(const std::string& cache_path) const {
+        const SceneCacheHeader& header = get_header();
+        const std::string temp_path = cache_path + ".tmp";
+        FILE* file = std::fopen(temp_path.c_str(), "wb");
+        if (!file) return false;
+        bool written = std::fwrite(data(), 1, image_size(header), file) == image_size(header);
+        written = std::fclose(file) == 0 && written;
+        if (written && std::rename(temp_path.c_str(), cache_path.c_str()) != 0) {
+            std::remove(cache_path.c_str());
+            written = std::rename(temp_path.c_str(), cache_path.c_str()) == 0;
+        }
+        if (!written) {
+            std::remove(temp_path.c_str());
+        }
+        return written;
+    }
+
+    // sets up the camera and the light and adds the objects to the scene
+    void apply(RaytracingEngine& engine) {
+        if (!data()) {
+            throw std::runtime_error("Scene file is empty");
+        }
+        const SceneSettings& settings = get_settings();
+        engine.camera.set_position(vec(settings.camera_position));
+        engine.camera.set_direction(vec(settings.camera_direction));
+        engine.camera.set_fov(settings.camera_fov);
+        engine.light.set_position(vec(settings.light_position));
+        engine.light.set_power(settings.light_power);
+
+        const SceneCacheHeader& header = get_header();
+        const SceneObjectRecord* objects = get_objects();
+        added.clear();
+        frame = 0;
+        for (uint32_t k = 0; k < header.num_objects; ++k) {
+            const SceneObjectRecord& record = objects[k];
+            const float* v = record.values;
+            if (record.path >= static_cast<int32_t>(header.num_paths)) {
+                throw std::runtime_error("Bad path index in scene file");
+            }
+            if (record.path >= 0) {
+                const ScenePathRecord& path = get_paths()[record.path];
+                if (path.leg_frames <= 0 || path.num_waypoints <= 0 || path.first_waypoint < 0 ||
+                    static_cast<uint32_t>(path.first_waypoint + path.num_waypoints) > header.num_waypoints) {
+                    throw std::runtime_error("Bad path in scene file");
+                }
+            }
+            Scene& scene = engine.scene;
+            switch (record.kind) {
+                case ObjectRef::PLANE: added.push_back(&scene.add_object(Plane(vec(v), vec(v + 3), v[6]))); break;
+                case ObjectRef::CHESS_PLANE: added.push_back(&scene.add_object(ChessPlane(vec(v), vec(v + 3), v[6], v[7], v[8]))); break;
+                case ObjectRef::SPHERE: added.push_back(&scene.add_object(Sphere(vec(v), v[3], v[4]))); break;
+                case ObjectRef::RECT: added.push_back(&scene.add_object(Rect(vec(v), vec(v + 3), vec(v + 6), v[9], v[10], v[11]))); break;
+                case ObjectRef::RECT_PRISM: added.push_back(&scene.add_object(RectPrism(vec(v), vec(v + 3), vec(v + 6), v[9], v[10], v[11], v[12]))); break;
+                case ObjectRef::CUBE: added.push_back(&scene.add_object(Cube(vec(v), vec(v + 3), vec(v + 6), v[9], v[10]))); break;
+                case ObjectRef::CYLINDER: added.push_back(&scene.add_object(Cylinder(vec(v), vec(v + 3), v[6], v[7], v[8]))); break;
+                case ObjectRef::CONE: added.push_back(&scene.add_object(Cone(vec(v), vec(v + 3), v[6], v[7], v[8]))); break;
+                default: throw std::runtime_error("Bad object kind in scene file");
+            }
+        }
+    }
+
+    // moves a camera and a light from the given frame of the scene's orbits to the next one
+    void animate_view(int at_frame, Camera& camera, Light& light) const {
+        const SceneSettings& settings = get_settings();
+        Vec3 camera_orbit = vec(settings.camera_orbit);
+        if (camera_orbit.norm() > 0) {
+            const int swing = settings.camera_swing;
+            // reversing every swing frames, starting half way, swings the camera around where it started
+            bool reversed = swing > 0 && (at_frame + swing / 2) / swing % 2 == 1;
+            camera.rotate_around_point(vec(settings.camera_orbit_point), reversed ? -camera_orbit : camera_orbit);
+        }
+
+        Vec3 light_orbit = vec(settings.light_orbit);
+        if (light_orbit.norm() > 0) {
+            light.rotate_around_point(vec(settings.light_orbit_point), light_orbit);
+        }
+    }
+
+    // advances the animation of an engine set up with apply by one frame
+    void animate(RaytracingEngine& engine) {
+        animate_view(frame, engine.camera, engine.light);
+
+        const SceneObjectRecord* objects = get_objects();
+        const ScenePathRecord* paths = get_paths();
+        for (size_t k = 0; k < added.size(); ++k) {
+            if (objects[k].path < 0) continue;
+            const ScenePathRecord& path = paths[objects[k].path];
+            engine.scene.move_object(added[k], path_offset(path, frame + 1) - path_offset(path, frame));
+        }
+        ++frame;
+    }
+
+    int get_num_objects() const {
+        return data() ? static_cast<int>(get_header().num_objects) : 0;
+    }
+
+    // whether load() mapped the cache instead of parsing the text
+    bool is_from_cache() const {
+        return from_cache;
+    }
+};
+
+#endif //SCENE_FILE_H_INCLUDED
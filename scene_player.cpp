@@ -0,0 +1,63 @@
+#include "engine.h"
+#include "terminal_sink.h"
+#include "async_sink.h"
+#include "scene_file.h"
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+// axes: X - left, Z - forward, Y - down
+//
+// usage: scene_player FILE [--fps N] [--heatmap]
+// plays a scene file such as scenes/example1.scene in the terminal, following the size of the terminal;
+// with --fps the resolution and the reflection depth are lowered as needed to hold N frames per second,
+// --heatmap draws how long every pixel takes instead of the image
+
+int main(int argc, char** argv) {
+    float fps = 0;
+    bool heatmap = false;
+    bool valid = argc >= 2;
+    for (int k = 2; k < argc && valid; ++k) {
+        std::string arg = argv[k];
+        if (arg == "--fps" && k + 1 < argc) fps = static_cast<float>(std::atof(argv[++k]));
+        else if (arg == "--heatmap") heatmap = true;
+        else valid = false;
+    }
+    if (!valid) {
+        std::fprintf(stderr, "usage: %s FILE [--fps N] [--heatmap]\n", argv[0]);
+        return 2;
+    }
+
+    const int width = 274; // <- set your console window width
+    const int height = 66; // <- set your console window height
+    const float font_width = 6.0; // <- set your console font width (in pixels)
+    const float font_height = 12.0; // <- set your console font height (in pixels)
+
+    const float pixel_aspect = font_width / font_height;
+    RaytracingEngine engine(width, height, pixel_aspect);
+
+    SceneFile scene_file;
+    try {
+        scene_file = SceneFile::load(argv[1]);
+        scene_file.apply(engine);
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    try {
+        engine.set_target_fps(fps);
+        engine.set_heatmap(heatmap);
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 2;
+    }
+    engine.set_output_sink(std::make_unique<AsyncSink>(make_terminal_sink()));
+
+    while (true) {
+        auto size = get_terminal_size();
+        if (size && (size->first != engine.get_width() || size->second != engine.get_height())) {
+            engine.resize(size->first, size->second);
+        }
+        engine.render_frame();
+        scene_file.animate(engine);
+    }
+}
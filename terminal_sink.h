@@ -0,0 +1,154 @@
+#ifndef TERMINAL_SINK_H_INCLUDED
+#define TERMINAL_SINK_H_INCLUDED
+#include "output_sink.h"
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <cerrno>
+#endif
+
+
+#ifdef _WIN32
+
+class Win32ConsoleSink : public OutputSink {
+private:
+    HANDLE hConsole;
+    DWORD dwBytesWritten;
+    FrameDiff frame_diff;
+    int last_width = 0;
+    int last_height = 0;
+
+    void clear() {
+        CONSOLE_SCREEN_BUFFER_INFO info;
+        if (GetConsoleScreenBufferInfo(hConsole, &info)) {
+            FillConsoleOutputCharacter(hConsole, ' ', info.dwSize.X * info.dwSize.Y, { 0, 0 }, &dwBytesWritten);
+        }
+    }
+
+public:
+    explicit Win32ConsoleSink(float full_redraw_fraction = 0.5): frame_diff(full_redraw_fraction) {
+        hConsole = CreateConsoleScreenBuffer(GENERIC_READ | GENERIC_WRITE, 0, NULL, CONSOLE_TEXTMODE_BUFFER, NULL);
+        SetConsoleActiveScreenBuffer(hConsole);
+        dwBytesWritten = 0;
+    }
+
+    void present(const char* screen, int width, int height) override {
+        // a smaller frame would leave the edges of the previous one on screen
+        if ((width != last_width || height != last_height) && last_width > 0) {
+            clear();
+        }
+        last_width = width;
+        last_height = height;
+        bool delta = frame_diff.diff(screen, width, height, [&](int row, int col, int length) {
+            COORD pos = { static_cast<SHORT>(col), static_cast<SHORT>(row) };
+            WriteConsoleOutputCharacter(hConsole, screen + row * width + col, length, pos, &dwBytesWritten);
+        });
+        if (!delta) {
+            WriteConsoleOutputCharacter(hConsole, screen, width * height, { 0, 0 }, &dwBytesWritten);
+        }
+    }
+};
+
+#else
+
+class AnsiTerminalSink : public OutputSink {
+// Builds the frame with cursor positioning escape sequences and hands it to a single write().
+// Only the cells that changed since the previous frame are rewritten, unless more than
+// full_redraw_fraction of them did.
+private:
+    int fd;
+    std::string buffer;
+    FrameDiff frame_diff;
+    int last_width = 0;
+    int last_height = 0;
+
+    void write_all(const char* data, size_t size) {
+        while (size > 0) {
+            ssize_t written = ::write(fd, data, size);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                return;
+            }
+            data += written;
+            size -= static_cast<size_t>(written);
+        }
+    }
+
+    void append_cursor_move(int row, int col) {
+        buffer += "\x1b[";
+        buffer += std::to_string(row + 1);
+        buffer += ';';
+        buffer += std::to_string(col + 1);
+        buffer += 'H';
+    }
+
+public:
+    explicit AnsiTerminalSink(int fd = STDOUT_FILENO, float full_redraw_fraction = 0.5): fd(fd), frame_diff(full_redraw_fraction) {
+        const char init[] = "\x1b[?25l\x1b[2J";
+        write_all(init, sizeof(init) - 1);
+    }
+
+    void present(const char* screen, int width, int height) override {
+        buffer.clear();
+        // a smaller frame would leave the edges of the previous one on screen
+        if ((width != last_width || height != last_height) && last_width > 0) {
+            buffer += "\x1b[2J";
+        }
+        last_width = width;
+        last_height = height;
+        bool delta = frame_diff.diff(screen, width, height, [&](int row, int col, int length) {
+            append_cursor_move(row, col);
+            buffer.append(screen + row * width + col, length);
+        });
+        if (!delta) {
+            for (int i = 0; i < height; ++i) {
+                append_cursor_move(i, 0);
+                buffer.append(screen + i * width, width);
+            }
+        }
+        if (buffer.empty()) return;
+        write_all(buffer.data(), buffer.size());
+    }
+
+    ~AnsiTerminalSink() {
+        const char restore[] = "\x1b[0m\x1b[?25h\r\n";
+        write_all(restore, sizeof(restore) - 1);
+    }
+};
+
+#endif
+
+
+// columns and rows of the console window, nullopt when the output isn't a terminal
+inline std::optional<std::pair<int, int>> get_terminal_size() {
+#ifdef _WIN32
+    CONSOLE_SCREEN_BUFFER_INFO info;
+    if (!GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &info)) {
+        return std::nullopt;
+    }
+    return std::make_pair(info.srWindow.Right - info.srWindow.Left + 1, info.srWindow.Bottom - info.srWindow.Top + 1);
+#else
+    winsize size;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) != 0 || size.ws_col == 0 || size.ws_row == 0) {
+        return std::nullopt;
+    }
+    return std::make_pair(static_cast<int>(size.ws_col), static_cast<int>(size.ws_row));
+#endif
+}
+
+
+inline std::unique_ptr<OutputSink> make_terminal_sink() {
+#ifdef _WIN32
+    return std::make_unique<Win32ConsoleSink>();
+#else
+    return std::make_unique<AnsiTerminalSink>();
+#endif
+}
+
+#endif //TERMINAL_SINK_H_INCLUDED
@@ -0,0 +1,177 @@
+#ifndef THREAD_POOL_H_INCLUDED
+#define THREAD_POOL_H_INCLUDED
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+
+class ThreadPool {
+// parallel_for splits the tasks into one contiguous range per worker (the calling thread is worker 0).
+// A worker takes tasks from the front of its own range and, when it runs dry, steals from the back of the others.
+private:
+    struct alignas(64) TaskRange {
+        std::atomic<uint64_t> bounds{0}; // low 32 bits - next task, high 32 bits - end of the range
+    };
+
+    std::vector<std::thread> threads;
+    std::unique_ptr<TaskRange[]> ranges;
+    int num_workers;
+
+    void (*job_fn)(void*, int) = nullptr;
+    void* job_ctx = nullptr;
+    std::exception_ptr job_error;
+
+    std::mutex mutex;
+    std::condition_variable job_cv;
+    std::condition_variable done_cv;
+    uint64_t generation = 0;
+    int busy_workers = 0;
+    bool stopping = false;
+
+    static uint64_t pack(uint32_t begin, uint32_t end) {
+        return (static_cast<uint64_t>(end) << 32) | begin;
+    }
+
+    static bool pop_front(TaskRange& range, int& task) {
+        uint64_t bounds = range.bounds.load(std::memory_order_relaxed);
+        while (true) {
+            uint32_t begin = static_cast<uint32_t>(bounds);
+            uint32_t end = static_cast<uint32_t>(bounds >> 32);
+            if (begin >= end) return false;
+            if (range.bounds.compare_exchange_weak(bounds, pack(begin + 1, end), std::memory_order_acq_rel)) {
+                task = begin;
+                return true;
+            }
+        }
+    }
+
+    static bool steal_back(TaskRange& range, int& task) {
+        uint64_t bounds = range.bounds.load(std::memory_order_relaxed);
+        while (true) {
+            uint32_t begin = static_cast<uint32_t>(bounds);
+            uint32_t end = static_cast<uint32_t>(bounds >> 32);
+            if (begin >= end) return false;
+            if (range.bounds.compare_exchange_weak(bounds, pack(begin, end - 1), std::memory_order_acq_rel)) {
+                task = end - 1;
+                return true;
+            }
+        }
+    }
+
+    void run_task(int task) {
+        try {
+            job_fn(job_ctx, task);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!job_error) job_error = std::current_exception();
+        }
+    }
+
+    void work(int worker) {
+        int task;
+        while (pop_front(ranges[worker], task)) {
+            run_task(task);
+        }
+        for (int k = 1; k < num_workers; ++k) {
+            TaskRange& victim = ranges[(worker + k) % num_workers];
+            while (steal_back(victim, task)) {
+                run_task(task);
+            }
+        }
+    }
+
+    void worker_loop(int worker) {
+        uint64_t seen_generation = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                job_cv.wait(lock, [&] { return stopping || generation != seen_generation; });
+                if (stopping) return;
+                seen_generation = generation;
+            }
+            work(worker);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (--busy_workers == 0) done_cv.notify_one();
+            }
+        }
+    }
+
+public:
+    // num_threads counts the calling thread; 0 means one thread per hardware core
+    explicit ThreadPool(int num_threads = 0) {
+        if (num_threads <= 0) {
+            num_threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        num_workers = num_threads;
+        ranges.reset(new TaskRange[num_workers]);
+        for (int w = 1; w < num_workers; ++w) {
+            threads.emplace_back(&ThreadPool::worker_loop, this, w);
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int size() const {
+        return num_workers;
+    }
+
+    template <class F>
+    void parallel_for(int num_tasks, F&& f) {
+        if (num_workers == 1 || num_tasks <= 1) {
+            for (int task = 0; task < num_tasks; ++task) {
+                f(task);
+            }
+            return;
+        }
+
+        using Fn = std::remove_reference_t<F>;
+        job_fn = [](void* ctx, int task) { (*static_cast<Fn*>(ctx))(task); };
+        job_ctx = const_cast<void*>(static_cast<const void*>(&f));
+        job_error = nullptr;
+
+        for (int w = 0; w < num_workers; ++w) {
+            uint32_t begin = static_cast<uint32_t>(static_cast<int64_t>(num_tasks) * w / num_workers);
+            uint32_t end = static_cast<uint32_t>(static_cast<int64_t>(num_tasks) * (w + 1) / num_workers);
+            ranges[w].bounds.store(pack(begin, end), std::memory_order_relaxed);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            busy_workers = num_workers - 1;
+            ++generation;
+        }
+        job_cv.notify_all();
+
+        work(0);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done_cv.wait(lock, [&] { return busy_workers == 0; });
+        if (job_error) {
+            std::exception_ptr error = job_error;
+            job_error = nullptr;
+            std::rethrow_exception(error);
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        job_cv.notify_all();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+};
+
+#endif //THREAD_POOL_H_INCLUDED
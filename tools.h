@@ -1,72 +1,65 @@
 #ifndef TOOLS_H_INCLUDED
 #define TOOLS_H_INCLUDED
 #include <cmath>
-#include <vector>
 #include <initializer_list>
 #include <stdexcept>
+#include <optional>
+#include <utility>
 
 
 class Vec3 {
 public:
     float x, y, z;
 
-    Vec3() : x(0), y(0), z(0) {}
-    Vec3(float x, float y, float z): x(x), y(y), z(z) {}
+    constexpr Vec3() : x(0), y(0), z(0) {}
+    constexpr Vec3(float x, float y, float z): x(x), y(y), z(z) {}
 
-    Vec3& operator+=(const Vec3& other) {
+    constexpr Vec3& operator+=(const Vec3& other) {
         x += other.x;
         y += other.y;
         z += other.z;
         return *this;
     }
 
-    Vec3& operator-=(const Vec3& other) {
+    constexpr Vec3& operator-=(const Vec3& other) {
         x -= other.x;
         y -= other.y;
         z -= other.z;
         return *this;
     }
 
-    Vec3& operator*=(float t) {
+    constexpr Vec3& operator*=(float t) {
         x *= t;
         y *= t;
         z *= t;
         return *this;
     }
 
-    Vec3 operator+(const Vec3& other) const {
+    constexpr Vec3 operator+(const Vec3& other) const {
         return Vec3(x + other.x, y + other.y, z + other.z);
     }
 
-    Vec3 operator-(const Vec3& other) const {
+    constexpr Vec3 operator-(const Vec3& other) const {
         return Vec3(x - other.x, y - other.y, z - other.z);
     }
 
-    Vec3 operator-() const {
+    constexpr Vec3 operator-() const {
         return Vec3(-x, -y, -z);
     }
 
-    Vec3 operator*(float t) const {
+    constexpr Vec3 operator*(float t) const {
         return Vec3(x * t, y * t, z * t);
     }
 
-    Vec3 rotate(float a, float b, float c) const {
-        return Vec3(cos(b) * cos(c) * x - cos(b) * sin(c) * y + sin(b) * z,
-                    (sin(a) * sin(b) * cos(c) + cos(a) * sin(c)) * x + (cos(a) * cos(c) - sin(a) * sin(b) * sin(c)) * y - sin(a) * cos(b) * z,
-                    (sin(a) * sin(c) - cos(a) * sin(b) * cos(c)) * x + (cos(a) * sin(b) * sin(c) + sin(a) * cos(c)) * y + cos(a) * cos(b) * z);
-    }
-
-    Vec3 rotate(const Vec3& w) const {
-        return Vec3(cos(w.y) * cos(w.z) * x - cos(w.y) * sin(w.z) * y + sin(w.y) * z,
-                    (sin(w.x) * sin(w.y) * cos(w.z) + cos(w.x) * sin(w.z)) * x + (cos(w.x) * cos(w.z) - sin(w.x) * sin(w.y) * sin(w.z)) * y - sin(w.x) * cos(w.y) * z,
-                    (sin(w.x) * sin(w.z) - cos(w.x) * sin(w.y) * cos(w.z)) * x + (cos(w.x) * sin(w.y) * sin(w.z) + sin(w.x) * cos(w.z)) * y + cos(w.x) * cos(w.y) * z);
-    }
+    // rotation by the angles around X, Y and Z, see Mat3
+    Vec3 rotate(float a, float b, float c) const;
+    Vec3 rotate(const Vec3& w) const;
 
-    float dot(const Vec3& v) const {
+    constexpr float dot(const Vec3& v) const {
         return x * v.x + y * v.y + z * v.z;
     }
     
-    Vec3 cross(const Vec3& v) const {
+    constexpr Vec3 cross(const Vec3& v) const {
         return Vec3(y * v.z - z * v.y, z * v.x - x * v.z, x * v.y - y * v.x);
     }
 
@@ -74,7 +67,14 @@ public:
         return std::sqrt(x * x + y * y + z * z);
     }
 
+    // for the tracing code: no check, a zero vector comes back as it is
     Vec3 normalized() const {
+        const float n = norm();
+        return n > 0 ? Vec3(x / n, y / n, z / n) : *this;
+    }
+
+    // for validating directions given to constructors and setters
+    Vec3 normalized_checked() const {
         float n = norm();
         if (n == 0) throw std::runtime_error("Zero length vector!");
         return Vec3(x / n, y / n, z / n);
@@ -82,46 +82,165 @@ public:
 };
 
 
-class RotationMat {
+class AABB {
+public:
+    Vec3 min, max;
+
+    AABB() : min(INFINITY, INFINITY, INFINITY), max(-INFINITY, -INFINITY, -INFINITY) {}
+    AABB(const Vec3& min, const Vec3& max) : min(min), max(max) {}
+
+    void expand(const Vec3& p) {
+        min = Vec3(std::fmin(min.x, p.x), std::fmin(min.y, p.y), std::fmin(min.z, p.z));
+        max = Vec3(std::fmax(max.x, p.x), std::fmax(max.y, p.y), std::fmax(max.z, p.z));
+    }
+
+    void expand(const AABB& other) {
+        // an empty box has min above max, its corners are no points to take in
+        if (other.min.x > other.max.x) return;
+        expand(other.min);
+        expand(other.max);
+    }
+
+    Vec3 center() const {
+        return (min + max) * 0.5;
+    }
+
+    float surface_area() const {
+        Vec3 d = max - min;
+        if (d.x < 0 || d.y < 0 || d.z < 0) return 0;
+        return 2 * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+
+    // entry distance of the ray into the box if it enters before t_max, inv_dir = 1/line_dir per component
+    std::optional<float> hit(const Vec3& line_point, const Vec3& inv_dir, float t_max) const {
+        float t_min = 0;
+        if (!clip_axis(line_point.x, inv_dir.x, min.x, max.x, t_min, t_max)) return std::nullopt;
+        if (!clip_axis(line_point.y, inv_dir.y, min.y, max.y, t_min, t_max)) return std::nullopt;
+        if (!clip_axis(line_point.z, inv_dir.z, min.z, max.z, t_min, t_max)) return std::nullopt;
+        return t_min;
+    }
+
 private:
-    std::vector<float> mat;
+    static bool clip_axis(float origin, float inv_dir, float lo, float hi, float& t_min, float& t_max) {
+        if (std::isinf(inv_dir)) {
+            return origin >= lo && origin <= hi;
+        }
+        float t0 = (lo - origin) * inv_dir;
+        float t1 = (hi - origin) * inv_dir;
+        if (t0 > t1) std::swap(t0, t1);
+        t_min = std::fmax(t_min, t0);
+        t_max = std::fmin(t_max, t1);
+        return t_min <= t_max;
+    }
+};
 
+
+class Quat {
+// Unit quaternion w + xi + yj + zk for composing rotations; Mat3(q) turns it into a matrix for rotating many vectors.
 public:
-    RotationMat(): mat(9, 0) {}
-
-    RotationMat(const Vec3& rotation_angles): mat(9) {
-        const float a = rotation_angles.x;
-        const float b = rotation_angles.y;
-        const float c = rotation_angles.z;
-        mat[0] = cos(b)*cos(c);
-        mat[1] = -cos(b)*sin(c);
-        mat[2] = sin(b);
-        mat[3] = sin(a)*sin(b)*cos(c) + cos(a)*sin(c);
-        mat[4] = cos(a)*cos(c) - sin(a)*sin(b)*sin(c);
-        mat[5] = -sin(a)*cos(b);
-        mat[6] = sin(a)*sin(c) - cos(a)*sin(b)*cos(c);
-        mat[7] = sin(a)*cos(c) + cos(a)*sin(b)*sin(c);
-        mat[8] = cos(a)*cos(b);
-    }
-
-    RotationMat(std::initializer_list<float> values) {
+    float w, x, y, z;
+
+    constexpr Quat(): w(1), x(0), y(0), z(0) {}
+    constexpr Quat(float w, float x, float y, float z): w(w), x(x), y(y), z(z) {}
+
+    static Quat from_axis_angle(const Vec3& axis, float angle) {
+        const Vec3 a = axis.normalized_checked() * std::sin(angle / 2);
+        return Quat(std::cos(angle / 2), a.x, a.y, a.z);
+    }
+
+    // the rotation of Mat3(rotation_angles)
+    static Quat from_angles(const Vec3& rotation_angles) {
+        return from_axis_angle(Vec3(1, 0, 0), rotation_angles.x) *
+               from_axis_angle(Vec3(0, 1, 0), rotation_angles.y) *
+               from_axis_angle(Vec3(0, 0, 1), rotation_angles.z);
+    }
+
+    // this rotation applied after other
+    constexpr Quat operator*(const Quat& other) const {
+        return Quat(w * other.w - x * other.x - y * other.y - z * other.z,
+                    w * other.x + x * other.w + y * other.z - z * other.y,
+                    w * other.y - x * other.z + y * other.w + z * other.x,
+                    w * other.z + x * other.y - y * other.x + z * other.w);
+    }
+
+    // inverse of a unit quaternion
+    constexpr Quat conjugate() const {
+        return Quat(w, -x, -y, -z);
+    }
+
+    // products of many quaternions drift away from unit length
+    Quat normalized() const {
+        const float n = std::sqrt(w * w + x * x + y * y + z * z);
+        return n > 0 ? Quat(w / n, x / n, y / n, z / n) : Quat();
+    }
+
+    constexpr Vec3 rotate(const Vec3& v) const {
+        const Vec3 u(x, y, z);
+        const Vec3 t = u.cross(v) * 2;
+        return v + t * w + u.cross(t);
+    }
+};
+
+
+class Mat3 {
+private:
+    float mat[9];
+
+    // sin and cos of the same angle next to each other, which compilers fuse into one sincos call
+    static void sin_cos(double angle, double& s, double& c) {
+        s = std::sin(angle);
+        c = std::cos(angle);
+    }
+
+public:
+    constexpr Mat3(): mat{0, 0, 0, 0, 0, 0, 0, 0, 0} {}
+
+    constexpr Mat3(float m0, float m1, float m2, float m3, float m4, float m5, float m6, float m7, float m8)
+        : mat{m0, m1, m2, m3, m4, m5, m6, m7, m8} {}
+
+    // the product Rx(a) Ry(b) Rz(c): rotation by c around Z, then b around Y, then a around X, in the fixed axes
+    Mat3(const Vec3& rotation_angles) {
+        double sa, ca, sb, cb, sc, cc;
+        sin_cos(rotation_angles.x, sa, ca);
+        sin_cos(rotation_angles.y, sb, cb);
+        sin_cos(rotation_angles.z, sc, cc);
+        mat[0] = cb*cc;
+        mat[1] = -cb*sc;
+        mat[2] = sb;
+        mat[3] = sa*sb*cc + ca*sc;
+        mat[4] = ca*cc - sa*sb*sc;
+        mat[5] = -sa*cb;
+        mat[6] = sa*sc - ca*sb*cc;
+        mat[7] = sa*cc + ca*sb*sc;
+        mat[8] = ca*cb;
+    }
+
+    // rotation of a unit quaternion
+    constexpr explicit Mat3(const Quat& q)
+        : mat{1 - 2 * (q.y * q.y + q.z * q.z), 2 * (q.x * q.y - q.w * q.z), 2 * (q.x * q.z + q.w * q.y),
+              2 * (q.x * q.y + q.w * q.z), 1 - 2 * (q.x * q.x + q.z * q.z), 2 * (q.y * q.z - q.w * q.x),
+              2 * (q.x * q.z - q.w * q.y), 2 * (q.y * q.z + q.w * q.x), 1 - 2 * (q.x * q.x + q.y * q.y)} {}
+
+    constexpr Mat3(std::initializer_list<float> values): mat{} {
         if (values.size() != 9) {
             throw std::invalid_argument("Matrix must have 9 elements.");
         }
-        mat.assign(values.begin(), values.end());
+        int k = 0;
+        for (float value : values) {
+            mat[k++] = value;
+        }
     }
 
-    Vec3 operator*(const Vec3& v) const {
+    constexpr Vec3 operator*(const Vec3& v) const {
         return Vec3(mat[0]*v.x + mat[1]*v.y + mat[2]*v.z,
                     mat[3]*v.x + mat[4]*v.y + mat[5]*v.z,
                     mat[6]*v.x + mat[7]*v.y + mat[8]*v.z);
     }
 
-    RotationMat operator*(const RotationMat& other) const {
-        RotationMat result;
+    constexpr Mat3 operator*(const Mat3& other) const {
+        Mat3 result;
         for (int i = 0; i < 3; ++i) {
             for (int j = 0; j < 3; ++j) {
-                result.mat[i * 3 + j] = 0;
                 for (int k = 0; k < 3; ++k) {
                     result.mat[i * 3 + j] += mat[i * 3 + k] * other.mat[k * 3 + j];
                 }
@@ -130,13 +249,31 @@ public:
         return result;
     }
 
-    bool is_null() const {
+    // inverse of a rotation
+    constexpr Mat3 transposed() const {
+        return Mat3(mat[0], mat[3], mat[6],
+                    mat[1], mat[4], mat[7],
+                    mat[2], mat[5], mat[8]);
+    }
+
+    constexpr bool is_null() const {
         float sum = 0;
-        for(float x : mat) {
-            sum += std::abs(x);
+        for (float x : mat) {
+            sum += x < 0 ? -x : x;
         }
         return (sum == 0);
     }
 };
 
+using RotationMat = Mat3;
+
+
+inline Vec3 Vec3::rotate(float a, float b, float c) const {
+    return Mat3(Vec3(a, b, c)) * *this;
+}
+
+inline Vec3 Vec3::rotate(const Vec3& w) const {
+    return Mat3(w) * *this;
+}
+
 #endif //TOOLS_H_INCLUDED
\ No newline at end of file